@@ -0,0 +1,170 @@
+#include "metric_scanner.hpp"
+#include "read_json.hpp"
+#include "server.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+
+// Microbenchmarks of the server hot paths. Every case runs a warm-up, then
+// REPETITIONS timed runs of at least MIN_RUN_TIME each; the results are
+// printed as one JSON object so that runs can be compared.
+const int REPETITIONS = 5;
+const auto MIN_RUN_TIME = std::chrono::milliseconds(100);
+
+class server_bench {
+public:
+  explicit server_bench(const std::string &path_to_config) {
+    MServer.read_config(path_to_config);
+  }
+
+  void run_all() {
+    bench_fft();
+    bench_confidence_score();
+    bench_json();
+    bench_handle_data();
+
+    json::object result;
+    result["benchmarks"] = std::move(MResults);
+    std::stringstream ss;
+    pretty_print(ss, result);
+    std::cout << ss.str();
+  }
+
+private:
+  void measure(const std::string &name, size_t items_per_op,
+               const std::function<void()> &op) {
+    typedef std::chrono::steady_clock clock;
+    op();
+
+    std::vector<double> ns_per_op;
+    uint64_t iterations = 0;
+    for (int rep = 0; rep < REPETITIONS; ++rep) {
+      uint64_t count = 0;
+      auto start_time = clock::now();
+      auto end_time = start_time;
+      do {
+        op();
+        ++count;
+        end_time = clock::now();
+      } while (end_time - start_time < MIN_RUN_TIME);
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    end_time - start_time)
+                    .count();
+      ns_per_op.push_back(double(ns) / count);
+      iterations += count;
+    }
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+
+    json::object entry;
+    entry["name"] = name.c_str();
+    entry["iterations"] = iterations;
+    entry["ns_per_op_min"] = ns_per_op.front();
+    entry["ns_per_op_median"] = ns_per_op[ns_per_op.size() / 2];
+    entry["items_per_second"] =
+        items_per_op * 1e9 / ns_per_op[ns_per_op.size() / 2];
+    MResults.push_back(std::move(entry));
+    std::cerr << name << ": " << ns_per_op[ns_per_op.size() / 2] << " ns/op"
+              << std::endl;
+  }
+
+  std::vector<int> random_samples(size_t count) {
+    std::uniform_int_distribution<int> dist(-1'000'000, 1'000'000);
+    std::vector<int> samples(count);
+    for (auto &sample : samples)
+      sample = dist(MRandom);
+    return samples;
+  }
+
+  void bench_fft() {
+    for (int bits = 4; bits <= 19; ++bits) {
+      size_t size = size_t(1) << bits;
+      auto samples = random_samples(size);
+      sample_span first{samples.data(), size / 2};
+      sample_span second{samples.data() + size / 2, size - size / 2};
+      measure("calculate_fft/" + std::to_string(size), size, [&] {
+        auto spectrum = MServer.calculate_fft(first, second);
+        sink(spectrum.data());
+      });
+    }
+  }
+
+  void bench_confidence_score() {
+    running_stats stats;
+    for (int sample : random_samples(MAX_NUM_METRICS))
+      stats.add(sample);
+    measure("calc_confidence_score/" + std::to_string(MAX_NUM_METRICS), 1,
+            [&] {
+              auto score = MServer.calc_confidence_score(1, stats);
+              sink(&score);
+            });
+  }
+
+  // The client message format: [{"_id": n, "data": [...]}, ...]
+  json::value client_batch(int num_metrics, int samples_per_metric) {
+    json::array batch;
+    for (int idm = 0; idm < num_metrics; ++idm) {
+      auto samples = random_samples(samples_per_metric);
+      json::object obj;
+      obj["_id"] = idm;
+      obj["data"] = json::array(samples.begin(), samples.end());
+      batch.push_back(std::move(obj));
+    }
+    return batch;
+  }
+
+  void bench_json() {
+    for (int num_metrics : {15, 1000}) {
+      auto batch = client_batch(num_metrics, 16);
+      std::string compact = json::serialize(batch);
+      std::string suffix = "/" + std::to_string(num_metrics) + "x16";
+      measure("parse_string" + suffix, compact.size(), [&] {
+        auto value = parse_string(compact);
+        sink(&value);
+      });
+      metric_batch scanned;
+      measure("scan_metrics_json" + suffix, compact.size(), [&] {
+        scan_metrics_json(compact.data(), compact.size(), scanned);
+        sink(scanned.samples.data());
+      });
+      measure("pretty_print" + suffix, 1, [&] {
+        std::stringstream ss;
+        pretty_print(ss, batch);
+        sink(&ss);
+      });
+      std::string out;
+      measure("serialize_compact" + suffix, 1, [&] {
+        out.clear();
+        serialize_compact(out, batch);
+        sink(out.data());
+      });
+    }
+  }
+
+  void bench_handle_data() {
+    for (int num_metrics : {15, 1000}) {
+      std::string batch = json::serialize(client_batch(num_metrics, 16));
+      std::vector<metric_score> scores;
+      measure("handle_data/" + std::to_string(num_metrics) + "x16",
+              num_metrics, [&] {
+                scores.clear();
+                MServer.handle_data(batch.data(), batch.size(), scores, false);
+                sink(scores.data());
+              });
+    }
+  }
+
+  // keeps the compiler from dropping a result
+  static void sink(const void *ptr) { asm volatile("" : : "g"(ptr) : "memory"); }
+
+  server MServer;
+  std::mt19937 MRandom{42};
+  json::array MResults;
+};
+
+int main(int argc, char *argv[]) {
+  server_bench bench(argc > 1 ? argv[1] : "./configs/server.cfg");
+  bench.run_all();
+  return 0;
+}
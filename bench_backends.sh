@@ -0,0 +1,41 @@
+#!/bin/bash
+
+# Runs the same open-loop load against the server once per I/O backend and
+# prints the client report and the syscalls the server made per message.
+# usage: ./bench_backends.sh [NUM_CLIENTS]
+
+SCRIPT_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" &> /dev/null && pwd)
+
+NUM_CLIENTS=${1:-100}
+SERVER_CFG=$SCRIPT_DIR/configs/server.cfg
+CLIENT_CFG=$SCRIPT_DIR/configs/client.cfg
+ADMIN_PORT=$(grep -o '"admin_port": *[0-9]*' $SERVER_CFG | grep -o '[0-9]*$')
+
+counter() {
+    echo "$1" | grep -o "\"$2\":[0-9]*" | grep -o '[0-9]*$'
+}
+
+for backend in epoll io_uring; do
+    cfg=$(mktemp)
+    sed "s/\"io_backend\": *\"[a-z_]*\"/\"io_backend\": \"$backend\"/" \
+        $SERVER_CFG > $cfg
+
+    ./server -c $cfg > /dev/null &
+    server_pid=$!
+    sleep 1
+
+    echo "=== $backend, $NUM_CLIENTS clients"
+    ./client -c $CLIENT_CFG -g $NUM_CLIENTS 2> /dev/null
+
+    stats=$(exec 3<>/dev/tcp/127.0.0.1/$ADMIN_PORT && cat <&3)
+    messages=$(counter "$stats" messages)
+    syscalls=$(counter "$stats" syscalls)
+    echo "messages: $messages, syscalls: $syscalls"
+    if [[ $messages -gt 0 ]]; then
+        awk "BEGIN { printf \"syscalls per message: %.3f\\n\", $syscalls / $messages }"
+    fi
+
+    kill $server_pid
+    wait $server_pid 2> /dev/null
+    rm -f $cfg
+done
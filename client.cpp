@@ -1,5 +1,7 @@
 #include "client.hpp"
 #include "connection.hpp"
+#include "frame.hpp"
+#include "protocol.hpp"
 #include "read_json.hpp"
 #include <arpa/inet.h>
 #include <cassert>
@@ -7,6 +9,7 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <poll.h>
 #include <syslog.h>
 
 using namespace std::chrono_literals;
@@ -24,29 +27,43 @@ client::~client() { close(MServerFd); }
 bool client::read_config(const std::string &str) {
   MConfig = parse_file(str.c_str());
   assert(!MConfig.is_null() && "Config is null!");
+  if (auto *val = MConfig.get_object().if_contains("protocol"))
+    MFormat = parse_wire_format(val->as_string().c_str());
+  if (auto *val = MConfig.get_object().if_contains("pretty_print"))
+    MPrettyPrint = val->as_bool();
+  if (auto *val = MConfig.get_object().if_contains("max_in_flight"))
+    MMaxInFlight = std::max<int64_t>(1, val->as_int64());
   // std::stringstream ss;
   // pretty_print(ss, MConfig);
   // syslog(LOG_DEBUG, "%s", ss.str().c_str());
   return true;
 }
 
-void client::connect_to_server() {
+int client::open_connection() {
   auto cfg = MConfig.get_object();
   std::string server_ip = json::serialize(cfg["ip_server"].get_string());
   uint64_t server_port = cfg["port_server"].get_int64();
-  int num_of_metrics = cfg["number_of_metrics"].get_int64();
 
   struct sockaddr_in server_addr = {0};
   set_sockaddr(&server_addr, server_port);
-  MServerFd = Socket(AF_INET, SOCK_STREAM, 0);
-  Connect(MServerFd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+  int server_fd = Socket(AF_INET, SOCK_STREAM, 0);
+  Connect(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+  return server_fd;
 }
 
+void client::connect_to_server() { MServerFd = open_connection(); }
+
 json::value client::collect_metrics_from_sensors() {
   auto cfg = MConfig.get_object();
-  const int num_of_metrics = cfg["number_of_metrics"].get_int64();
   const int rate_of_metrics = cfg["rate_of_metrics"].get_int64();
-  const auto &metrics = cfg["mask_of_metrics"].get_array();
+  return collect_metrics_from_sensors(cfg["mask_of_metrics"].get_array(),
+                                      rate_of_metrics);
+}
+
+json::value client::collect_metrics_from_sensors(const json::array &metrics,
+                                                 int rate_of_metrics) {
+  auto cfg = MConfig.get_object();
+  const int num_of_metrics = cfg["number_of_metrics"].get_int64();
 
   json::array value_to_send;
   value_to_send.reserve(metrics.size());
@@ -73,49 +90,108 @@ json::value client::collect_metrics_from_sensors() {
 void client::send_to_server(const json::value &value_to_send) {
   static uint64_t sent_msgs_count = 0;
   syslog(LOG_DEBUG, "Try to send Msg#: %lu", sent_msgs_count);
-  std::stringstream ss;
-  pretty_print(ss, value_to_send);
-  const auto &str = ss.str();
-  syslog(LOG_DEBUG, "Sending message: %s", str.c_str());
-  write(MServerFd, str.c_str(), str.length());
+  std::string str;
+  encode_request(str, value_to_send);
+
+  size_t sample_count = 0;
+  for (const auto &elem : value_to_send.get_array())
+    sample_count += elem.get_object().at("data").get_array().size();
+  syslog(LOG_DEBUG, "Message size: %zu bytes, %.2f bytes per sample",
+         str.length(), sample_count ? double(str.length()) / sample_count : 0.0);
+
+  write_frame(MServerFd, str.c_str(), str.length());
   syslog(LOG_DEBUG,
          "the message has been sent!"
          " total sent msgs: %lu",
          ++sent_msgs_count);
 }
 
-std::string client::receive_from_server(int expected_metric_count) {
+void client::encode_request(std::string &str,
+                            const json::value &value_to_send) {
+  str.clear();
+  if (MFormat == wire_format::binary) {
+    encode_metrics(str, value_to_send);
+  } else if (MPrettyPrint) {
+    std::stringstream ss;
+    pretty_print(ss, value_to_send);
+    str = ss.str();
+    syslog(LOG_DEBUG, "Sending message: %s", str.c_str());
+  } else {
+    serialize_compact(str, value_to_send);
+    syslog(LOG_DEBUG, "Sending message: %s", str.c_str());
+  }
+}
+
+void client::receive_from_server(const char *&data, size_t &size) {
   static uint64_t rec_msgs_count = 0;
   syslog(LOG_DEBUG, "Try to receive Msg#: %lu", rec_msgs_count);
-  std::stringstream ss;
-  char buf[1024];
-  while (true) {
-    int nbytes = read(MServerFd, buf, sizeof(buf));
+  data = "";
+  size = 0;
+  while (!MReader.next_frame(data, size)) {
+    if (MReader.is_broken()) {
+      syslog(LOG_ERR, "Client exits because it took a malformed frame!");
+      exit(EXIT_FAILURE);
+    }
+    int nbytes = MReader.read_some(MServerFd);
     if (nbytes == -1) {
       perror("read() failed");
       exit(EXIT_FAILURE);
     } else if (nbytes == 0) {
       close(MServerFd);
       break;
-    } else {
-      buf[nbytes] = '\0';
-      ss << buf;
-
-      auto recdata = parse_string(ss.str());
-      if (recdata.is_array() &&
-          recdata.get_array().size() == expected_metric_count) {
-        break;
-      }
     }
+    parse_received();
   }
 
-  syslog(LOG_DEBUG, "Client received: \"%s\"", ss.str().c_str());
+  syslog(LOG_DEBUG, "Client received: \"%.*s\"", int(size), data);
   syslog(LOG_DEBUG, "Total received msgs: %lu", ++rec_msgs_count);
-  if (ss.str().empty()) {
+  if (size == 0) {
     syslog(LOG_ERR, "Client exits because it took wrong/null data!");
     exit(EXIT_FAILURE);
   }
-  return ss.str();
+}
+
+void client::parse_received() {
+  // every byte is fed to the parser once, so a response costs O(size) no
+  // matter how many reads it takes
+  const char *data;
+  size_t size;
+  if (!MNeedSaveData || MParseFailed || !MReader.partial_frame(data, size) ||
+      size <= MParsedBytes || size < sizeof(BINARY_MAGIC) ||
+      detect_wire_format(data, size) != wire_format::json)
+    return;
+
+  json::error_code ec;
+  MParser.write(data + MParsedBytes, size - MParsedBytes, ec);
+  MParsedBytes = size;
+  if (ec)
+    MParseFailed = true;
+}
+
+json::value client::decode_response(const char *data, size_t size) {
+  if (detect_wire_format(data, size) == wire_format::json) {
+    json::error_code ec;
+    if (!MParseFailed && MParsedBytes < size)
+      MParser.write(data + MParsedBytes, size - MParsedBytes, ec);
+    if (!ec && !MParseFailed)
+      MParser.finish(ec);
+    json::value response = nullptr;
+    if (!ec && !MParseFailed)
+      response = MParser.release();
+    MParser.reset();
+    MParsedBytes = 0;
+    MParseFailed = false;
+    return response;
+  }
+
+  std::vector<metric_score> scores;
+  if (!decode_scores(data, size, scores))
+    return nullptr;
+  json::array response;
+  response.reserve(scores.size());
+  for (const auto &score : scores)
+    response.push_back(score_to_json(score));
+  return response;
 }
 
 void client::save_data_to_file(const json::value &data) {
@@ -157,6 +233,8 @@ void client::save_data_to_file(const json::value &data) {
 bool client::run() {
 
   connect_to_server();
+  if (MMaxInFlight > 1)
+    return run_pipelined();
 
   using ms = std::chrono::microseconds;
   auto prev_time = std::chrono::high_resolution_clock::now();
@@ -183,13 +261,116 @@ bool client::run() {
 
     send_to_server(data_to_send);
 
-    int expected_metric_count = data_to_send.get_array().size();
+    const char *rdata;
+    size_t rsize;
+    receive_from_server(rdata, rsize);
 
-    const auto &rdata_str = receive_from_server(expected_metric_count);
+    if (is_error_response(rdata, rsize)) {
+      syslog(LOG_WARNING, "Server rejected the batch as malformed");
+      if (MNeedSaveData)
+        decode_response(rdata, rsize);
+      continue;
+    }
+    if (MNeedSaveData)
+      save_data_to_file(decode_response(rdata, rsize));
+  }
+}
+
+void client::handle_response(const char *data, size_t size) {
+  // The server answers every request of a connection in order, a malformed
+  // one with an error, so the oldest batch in flight is the one this
+  // response belongs to
+  if (MInFlight.empty()) {
+    syslog(LOG_ERR, "Client exits because it took an unexpected response!");
+    exit(EXIT_FAILURE);
+  }
+  auto batch = MInFlight.front();
+  MInFlight.pop_front();
+  auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - batch.sent_at);
+  syslog(LOG_DEBUG, "Response to batch#: %lu after %ld usec, in flight: %zu",
+         batch.seq, latency.count(), MInFlight.size());
+
+  if (is_error_response(data, size)) {
+    syslog(LOG_WARNING, "Server rejected batch#: %lu as malformed", batch.seq);
+    // resets the parser that already took part of it
+    if (MNeedSaveData)
+      decode_response(data, size);
+    return;
+  }
+  if (MNeedSaveData)
+    save_data_to_file(decode_response(data, size));
+}
+
+bool client::run_pipelined() {
+  set_nonblocking(MServerFd);
+
+  typedef std::chrono::steady_clock clock;
+  uint64_t next_seq = 0;
+  auto next_tick = clock::now();
+
+  // Sending stays on the PERIOD schedule, responses are taken whenever they
+  // arrive. While MMaxInFlight batches are unanswered the tick is skipped,
+  // so a slow server gets no more than that from this client.
+  while (true) {
+    auto now = clock::now();
+    if (now >= next_tick) {
+      if (MInFlight.size() < MMaxInFlight) {
+        std::string str;
+        encode_request(str, collect_metrics_from_sensors());
+        MWriter.push(std::move(str));
+        MInFlight.push_back({next_seq++, now});
+      } else {
+        syslog(LOG_WARNING, "Skipped a tick, %zu batches in flight",
+               MInFlight.size());
+      }
+      next_tick += PERIOD;
+      // after a long stall start a new schedule instead of catching up
+      if (next_tick < now)
+        next_tick = now + PERIOD;
+    }
+
+    if (!MWriter.flush(MServerFd)) {
+      syslog(LOG_ERR, "Client exits because sending failed!");
+      exit(EXIT_FAILURE);
+    }
 
-    if (MNeedSaveData) {
-      const auto &rdata = parse_string(rdata_str);
-      save_data_to_file(rdata);
+    struct pollfd pfd = {MServerFd, POLLIN, 0};
+    if (!MWriter.empty())
+      pfd.events |= POLLOUT;
+    auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+        next_tick - clock::now());
+    if (poll(&pfd, 1, std::max<int64_t>(0, timeout.count())) == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("poll() failed");
+      exit(EXIT_FAILURE);
+    }
+    if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+      continue;
+
+    while (true) {
+      const char *data;
+      size_t size;
+      while (MReader.next_frame(data, size))
+        handle_response(data, size);
+      if (MReader.is_broken()) {
+        syslog(LOG_ERR, "Client exits because it took a malformed frame!");
+        exit(EXIT_FAILURE);
+      }
+
+      ssize_t nbytes = MReader.read_some(MServerFd);
+      if (nbytes == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          break;
+        perror("read() failed");
+        exit(EXIT_FAILURE);
+      } else if (nbytes == 0) {
+        syslog(LOG_ERR, "Client exits because the server closed the "
+                        "connection!");
+        exit(EXIT_FAILURE);
+      }
+      parse_received();
     }
   }
 }
@@ -1,7 +1,11 @@
 #ifndef __CLIENT_HPP__
 #define __CLIENT_HPP__
 
+#include "frame.hpp"
+#include "protocol.hpp"
 #include <boost/json.hpp>
+#include <chrono>
+#include <deque>
 
 namespace json = boost::json;
 using Config = json::value;
@@ -18,6 +22,18 @@ public:
 
   bool run();
 
+  inline const Config &config() const { return MConfig; }
+
+  // Opens a new connection to the configured server
+  int open_connection();
+
+  // One batch [{"_id": idm, "data": [...]}, ...] of the given metrics
+  json::value collect_metrics_from_sensors(const json::array &metrics,
+                                           int rate_of_metrics);
+
+  // Encodes a batch in the configured protocol
+  void encode_request(std::string &str, const json::value &value_to_send);
+
 private:
   void connect_to_server();
 
@@ -25,12 +41,38 @@ private:
 
   void send_to_server(const json::value &value_to_send);
 
-  std::string receive_from_server(int expected_metric_count);
+  void receive_from_server(const char *&data, size_t &size);
+
+  void parse_received();
+
+  json::value decode_response(const char *data, size_t size);
 
   void save_data_to_file(const json::value &data);
 
+  bool run_pipelined();
+
+  void handle_response(const char *data, size_t size);
+
+  // a batch sent but not answered yet
+  struct in_flight_batch {
+    uint64_t seq;
+    std::chrono::steady_clock::time_point sent_at;
+  };
+
   int MServerFd;
+  frame_reader MReader;
+  frame_writer MWriter;
+  // A JSON response is parsed while it arrives. The parser keeps its state
+  // across reads and is reused for every response.
+  json::stream_parser MParser;
+  size_t MParsedBytes = 0;
+  bool MParseFailed = false;
+  // more than one batch in flight switches to the pipelined loop
+  size_t MMaxInFlight = 1;
+  std::deque<in_flight_batch> MInFlight;
   Config MConfig;
+  wire_format MFormat = wire_format::json;
+  bool MPrettyPrint = false;
   bool MNeedSaveData = false;
 };
 
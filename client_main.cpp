@@ -1,4 +1,5 @@
 #include "client.hpp"
+#include "load_generator.hpp"
 #include <fstream>
 #include <iostream>
 #include <signal.h>
@@ -8,6 +9,7 @@
 const char *DAEMON_NAME = "client_daemon";
 int daemonize = 1;
 bool need_save_data = false;
+size_t load_connections = 0;
 std::string path_to_config = "./configs/client.cfg";
 
 void prepare_daemon(int daemonize) {
@@ -90,12 +92,18 @@ void handle_args(int argc, char *argv[]) {
                 << "-c"
                 << "  "
                 << "Path to config file used at startup." << std::endl;
+      std::cout << "\t"
+                << "-g N"
+                << "  "
+                << "Generate load from N connections in this process"
+                   " and report latencies. Implies -n."
+                << std::endl;
       std::cout << std::endl;
     }
   };
 
   int c;
-  while ((c = getopt(argc, argv, "nhlc:|help")) != -1) {
+  while ((c = getopt(argc, argv, "nhlc:g:|help")) != -1) {
     switch (c) {
     case 'h':
       print_usage();
@@ -111,6 +119,10 @@ void handle_args(int argc, char *argv[]) {
       path_to_config = optarg;
       // std::cout << "path_to_config = " << path_to_config << std::endl;
       break;
+    case 'g':
+      load_connections = std::stoul(optarg);
+      daemonize = 0;
+      break;
     default:
       print_usage();
       exit(0);
@@ -129,7 +141,12 @@ int main(int argc, char *argv[]) {
   client c;
   c.read_config(path_to_config);
   c.set_need_save_data(need_save_data);
-  c.run();
+  if (load_connections) {
+    load_generator generator(c, load_connections);
+    generator.run();
+  } else {
+    c.run();
+  }
 
   syslog(LOG_INFO, "%s daemon exiting", DAEMON_NAME);
   return 0;
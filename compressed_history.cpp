@@ -0,0 +1,103 @@
+#include "compressed_history.hpp"
+
+static inline uint64_t zigzag(int64_t value) {
+  return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value) {
+  return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+static inline uint8_t bits_of(uint64_t value) {
+  return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+void compressed_history::append(const int *samples, size_t count) {
+  MSize += count;
+  while (count > 0) {
+    if (MTail.capacity() < HISTORY_BLOCK_SAMPLES)
+      MTail.reserve(HISTORY_BLOCK_SAMPLES);
+    size_t n = std::min(count, HISTORY_BLOCK_SAMPLES - MTail.size());
+    MTail.insert(MTail.end(), samples, samples + n);
+    samples += n;
+    count -= n;
+    if (MTail.size() == HISTORY_BLOCK_SAMPLES)
+      seal_tail();
+  }
+}
+
+void compressed_history::seal_tail() {
+  const size_t count = MTail.size();
+  int min = MTail[0], max = MTail[0];
+  uint64_t max_delta = 0;
+  for (size_t i = 1; i < count; ++i) {
+    min = std::min(min, MTail[i]);
+    max = std::max(max, MTail[i]);
+    max_delta =
+        std::max(max_delta, zigzag(int64_t(MTail[i]) - int64_t(MTail[i - 1])));
+  }
+
+  MBlocks.emplace_back();
+  block &out = MBlocks.back();
+  out.count = count;
+  uint8_t offset_bits = bits_of(uint64_t(int64_t(max) - int64_t(min)));
+  uint8_t delta_bits = bits_of(max_delta);
+  out.delta = delta_bits < offset_bits;
+  out.bits = out.delta ? delta_bits : offset_bits;
+  out.base = out.delta ? MTail[0] : min;
+  out.words.assign((count * out.bits + 63) / 64, 0);
+
+  uint64_t *words = out.words.data();
+  for (size_t i = 0; i < count && out.bits; ++i) {
+    uint64_t value =
+        out.delta ? zigzag(int64_t(MTail[i]) - int64_t(i ? MTail[i - 1]
+                                                          : out.base))
+                  : uint64_t(int64_t(MTail[i]) - int64_t(min));
+    size_t pos = i * out.bits;
+    size_t shift = pos & 63;
+    words[pos >> 6] |= value << shift;
+    if (shift + out.bits > 64)
+      words[(pos >> 6) + 1] |= value >> (64 - shift);
+  }
+
+  MBlockBytes += sizeof(block) + out.words.capacity() * sizeof(uint64_t);
+  MTail.clear();
+}
+
+void compressed_history::decode_front() {
+  const block &in = MBlocks.front();
+  MHead.resize(in.count);
+  MHeadPos = 0;
+
+  const uint64_t *words = in.words.data();
+  const uint8_t bits = in.bits;
+  const uint64_t mask = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+  auto unpack = [&](size_t i) -> uint64_t {
+    if (!bits)
+      return 0;
+    size_t pos = i * bits;
+    size_t shift = pos & 63;
+    uint64_t value = words[pos >> 6] >> shift;
+    if (shift + bits > 64)
+      value |= words[(pos >> 6) + 1] << (64 - shift);
+    return value & mask;
+  };
+
+  if (in.delta) {
+    int64_t value = in.base;
+    for (size_t i = 0; i < in.count; ++i) {
+      value += unzigzag(unpack(i));
+      MHead[i] = value;
+    }
+  } else {
+    for (size_t i = 0; i < in.count; ++i)
+      MHead[i] = int64_t(in.base) + int64_t(unpack(i));
+  }
+
+  MBlockBytes -= sizeof(block) + in.words.capacity() * sizeof(uint64_t);
+  MBlocks.pop_front();
+}
+
+size_t compressed_history::memory_bytes() const {
+  return MBlockBytes + (MHead.capacity() + MTail.capacity()) * sizeof(int);
+}
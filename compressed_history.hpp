@@ -0,0 +1,73 @@
+#ifndef __COMPRESSED_HISTORY_HPP__
+#define __COMPRESSED_HISTORY_HPP__
+
+#include <algorithm>
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+const size_t HISTORY_BLOCK_SAMPLES = 1024;
+
+// FIFO of the samples that left a metric's hot window. They are only read
+// back in order, when they leave the whole window, so they are kept in
+// blocks of HISTORY_BLOCK_SAMPLES bit-packed values. A block either stores
+// the offsets from its minimum or the zigzag deltas between neighbours,
+// whichever needs fewer bits: smooth signals shrink to a few bits per
+// sample, noise to its actual range. The newest samples collect in a raw
+// tail until they fill a block.
+class compressed_history {
+public:
+  void append(const int *samples, size_t count);
+
+  // Drops the oldest count samples, fn(const int *data, size_t size) sees
+  // them first, in order
+  template <class Fn> void drop_front(size_t count, Fn &&fn) {
+    count = std::min(count, MSize);
+    MSize -= count;
+    while (count > 0) {
+      if (MHeadPos == MHead.size()) {
+        if (MBlocks.empty()) {
+          // the oldest samples are still in the raw tail
+          fn(MTail.data(), count);
+          MTail.erase(MTail.begin(), MTail.begin() + count);
+          return;
+        }
+        decode_front();
+      }
+      size_t n = std::min(count, MHead.size() - MHeadPos);
+      fn(MHead.data() + MHeadPos, n);
+      MHeadPos += n;
+      count -= n;
+    }
+  }
+
+  inline size_t size() const { return MSize; }
+
+  // heap bytes in use, the raw head and tail buffers included
+  size_t memory_bytes() const;
+
+private:
+  struct block {
+    uint32_t count;
+    // offsets from base, or zigzag deltas starting at base
+    bool delta;
+    uint8_t bits;
+    int32_t base;
+    std::vector<uint64_t> words;
+  };
+
+  void seal_tail();
+
+  // unpacks the oldest block into MHead
+  void decode_front();
+
+  std::deque<block> MBlocks;
+  size_t MBlockBytes = 0;
+  std::vector<int> MHead;
+  size_t MHeadPos = 0;
+  std::vector<int> MTail;
+  size_t MSize = 0;
+};
+
+#endif /* __COMPRESSED_HISTORY_HPP__ */
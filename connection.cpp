@@ -68,6 +68,26 @@ void epoll_ctl_add(int epfd, int fd, uint32_t events) {
   }
 }
 
+void epoll_ctl_mod(int epfd, int fd, uint32_t events) {
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+    perror("epoll_ctl() failed");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void epoll_ctl_add(int epfd, int fd, uint32_t events, void *ptr) {
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = ptr;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    perror("epoll_ctl() failed");
+    exit(EXIT_FAILURE);
+  }
+}
+
 void set_sockaddr(struct sockaddr_in *addr, int port) {
   addr->sin_family = AF_INET;
   addr->sin_addr.s_addr = INADDR_ANY;
@@ -18,6 +18,11 @@ void set_nonblocking(int fd);
 
 void epoll_ctl_add(int epfd, int fd, uint32_t events);
 
+void epoll_ctl_mod(int epfd, int fd, uint32_t events);
+
+// Registers fd with data.ptr instead of data.fd
+void epoll_ctl_add(int epfd, int fd, uint32_t events, void *ptr);
+
 void set_sockaddr(struct sockaddr_in *addr, int port);
 
 #endif /* __CONNECTION_HPP__ */
@@ -0,0 +1,191 @@
+#include "fft.hpp"
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FFT_HAVE_X86_SIMD 1
+#endif
+
+const double PI = 3.141592653589793;
+
+fft_plan::fft_plan(size_t size)
+    : size(size), half(size / 2), bitrev(half), stage_re(half - 1),
+      stage_im(half - 1), post_re(half), post_im(half) {
+  size_t bits = 0;
+  while ((size_t(1) << bits) < half)
+    ++bits;
+  for (size_t m = 0; m < half; ++m) {
+    uint32_t r = 0;
+    for (size_t b = 0; b < bits; ++b)
+      r |= ((m >> b) & 1) << (bits - 1 - b);
+    bitrev[m] = r;
+  }
+
+  for (size_t h = 1; h < half; h *= 2) {
+    for (size_t j = 0; j < h; ++j) {
+      double theta = -PI * j / h;
+      stage_re[h - 1 + j] = cos(theta);
+      stage_im[h - 1 + j] = sin(theta);
+    }
+  }
+
+  for (size_t k = 0; k < half; ++k) {
+    double theta = -2 * PI * k / size;
+    post_re[k] = cos(theta);
+    post_im[k] = sin(theta);
+  }
+}
+
+const fft_plan &get_fft_plan(size_t size) {
+  static std::mutex lock;
+  static std::unordered_map<size_t, std::unique_ptr<fft_plan>> plans;
+
+  std::lock_guard<std::mutex> guard(lock);
+  auto &plan = plans[size];
+  if (!plan)
+    plan.reset(new fft_plan(size));
+  return *plan;
+}
+
+// One radix-2 stage over blocks of 2h elements: a' = a + w*b, b' = a - w*b.
+// The SIMD variants do exactly the same operations in the same order, so all
+// of them produce bit-identical results.
+static void stage_scalar(double *re, double *im, const double *tw_re,
+                         const double *tw_im, size_t half, size_t h) {
+  for (size_t s = 0; s < half; s += 2 * h) {
+    double *ar = re + s, *ai = im + s, *br = re + s + h, *bi = im + s + h;
+    for (size_t j = 0; j < h; ++j) {
+      double tr = br[j] * tw_re[j] - bi[j] * tw_im[j];
+      double ti = br[j] * tw_im[j] + bi[j] * tw_re[j];
+      br[j] = ar[j] - tr;
+      bi[j] = ai[j] - ti;
+      ar[j] = ar[j] + tr;
+      ai[j] = ai[j] + ti;
+    }
+  }
+}
+
+#ifdef FFT_HAVE_X86_SIMD
+__attribute__((target("sse2"))) static void
+stage_sse2(double *re, double *im, const double *tw_re, const double *tw_im,
+           size_t half, size_t h) {
+  if (h < 2)
+    return stage_scalar(re, im, tw_re, tw_im, half, h);
+  for (size_t s = 0; s < half; s += 2 * h) {
+    double *ar = re + s, *ai = im + s, *br = re + s + h, *bi = im + s + h;
+    for (size_t j = 0; j < h; j += 2) {
+      __m128d wr = _mm_loadu_pd(tw_re + j);
+      __m128d wi = _mm_loadu_pd(tw_im + j);
+      __m128d xr = _mm_loadu_pd(br + j);
+      __m128d xi = _mm_loadu_pd(bi + j);
+      __m128d tr = _mm_sub_pd(_mm_mul_pd(xr, wr), _mm_mul_pd(xi, wi));
+      __m128d ti = _mm_add_pd(_mm_mul_pd(xr, wi), _mm_mul_pd(xi, wr));
+      __m128d yr = _mm_loadu_pd(ar + j);
+      __m128d yi = _mm_loadu_pd(ai + j);
+      _mm_storeu_pd(br + j, _mm_sub_pd(yr, tr));
+      _mm_storeu_pd(bi + j, _mm_sub_pd(yi, ti));
+      _mm_storeu_pd(ar + j, _mm_add_pd(yr, tr));
+      _mm_storeu_pd(ai + j, _mm_add_pd(yi, ti));
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static void
+stage_avx2(double *re, double *im, const double *tw_re, const double *tw_im,
+           size_t half, size_t h) {
+  if (h < 4)
+    return stage_sse2(re, im, tw_re, tw_im, half, h);
+  for (size_t s = 0; s < half; s += 2 * h) {
+    double *ar = re + s, *ai = im + s, *br = re + s + h, *bi = im + s + h;
+    for (size_t j = 0; j < h; j += 4) {
+      __m256d wr = _mm256_loadu_pd(tw_re + j);
+      __m256d wi = _mm256_loadu_pd(tw_im + j);
+      __m256d xr = _mm256_loadu_pd(br + j);
+      __m256d xi = _mm256_loadu_pd(bi + j);
+      __m256d tr =
+          _mm256_sub_pd(_mm256_mul_pd(xr, wr), _mm256_mul_pd(xi, wi));
+      __m256d ti =
+          _mm256_add_pd(_mm256_mul_pd(xr, wi), _mm256_mul_pd(xi, wr));
+      __m256d yr = _mm256_loadu_pd(ar + j);
+      __m256d yi = _mm256_loadu_pd(ai + j);
+      _mm256_storeu_pd(br + j, _mm256_sub_pd(yr, tr));
+      _mm256_storeu_pd(bi + j, _mm256_sub_pd(yi, ti));
+      _mm256_storeu_pd(ar + j, _mm256_add_pd(yr, tr));
+      _mm256_storeu_pd(ai + j, _mm256_add_pd(yi, ti));
+    }
+  }
+}
+#endif
+
+fft_engine::fft_engine() : MStage(stage_scalar) {
+#ifdef FFT_HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    MStage = stage_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    MStage = stage_sse2;
+#endif
+}
+
+const fft_plan &fft_engine::plan_for(size_t size) {
+  auto &plan = MPlans[size];
+  if (!plan)
+    plan = &get_fft_plan(size);
+  return *plan;
+}
+
+void fft_engine::magnitudes(const sample_span &first,
+                            const sample_span &second, int *out) {
+  const size_t size = first.size + second.size;
+  auto sample = [&](size_t k) -> double {
+    return k < first.size ? first.data[k] : second.data[k - first.size];
+  };
+
+  if (size == 1) {
+    out[0] = 2 * std::abs(sample(0));
+    return;
+  }
+
+  // Pack the real signal into a half-size complex one, z[m] = x[2m] +
+  // i*x[2m+1], in bit-reversed order
+  const auto &plan = plan_for(size);
+  const size_t half = plan.half;
+  MRe.resize(half);
+  MIm.resize(half);
+  double *re = MRe.data();
+  double *im = MIm.data();
+  for (size_t m = 0; m < half; ++m) {
+    re[plan.bitrev[m]] = sample(2 * m);
+    im[plan.bitrev[m]] = sample(2 * m + 1);
+  }
+
+  for (size_t h = 1; h < half; h *= 2)
+    MStage(re, im, plan.stage_re.data() + h - 1, plan.stage_im.data() + h - 1,
+           half, h);
+
+  // Unpack X[k] = E[k] + W^k * O[k] for k = 0..N/2. The spectrum of a real
+  // signal is symmetric, so the upper half mirrors the lower one.
+  // FFT_analysis advanced its twiddle recurrence before the first butterfly
+  // of every stage, which makes its bin k hold X[k + 1]. The shift is kept so
+  // that the output stays the same.
+  auto bin = [size](size_t k) { return (k + size - 1) % size; };
+  for (size_t k = 0; k <= half; ++k) {
+    size_t a = k % half;
+    size_t b = (half - k) % half;
+    double zr = re[a], zi = im[a];
+    double cr = re[b], ci = -im[b];
+    double er = (zr + cr) / 2, ei = (zi + ci) / 2;
+    double or_ = (zi - ci) / 2, oi = -(zr - cr) / 2;
+    double wr = k < half ? plan.post_re[k] : -1.0;
+    double wi = k < half ? plan.post_im[k] : 0.0;
+    double xr = er + (wr * or_ - wi * oi);
+    double xi = ei + (wr * oi + wi * or_);
+
+    int magnitude = 2 * sqrt(xr * xr + xi * xi) / size;
+    out[bin(k)] = magnitude;
+    if (k > 0 && k < half)
+      out[bin(size - k)] = magnitude;
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef __FFT_HPP__
+#define __FFT_HPP__
+
+#include "sample_ring.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// Precomputed tables for one transform size. A real N-point input is packed
+// into an N/2-point complex transform, so every table is sized for N/2.
+// Plans are immutable once built and shared by all threads.
+struct fft_plan {
+  explicit fft_plan(size_t size);
+
+  size_t size;
+  size_t half;
+  // bit-reversed position of every complex input element
+  std::vector<uint32_t> bitrev;
+  // twiddles of each radix-2 stage, stage h starts at offset h - 1
+  std::vector<double> stage_re;
+  std::vector<double> stage_im;
+  // exp(-2*pi*i*k/N), used to unpack the half-size transform
+  std::vector<double> post_re;
+  std::vector<double> post_im;
+};
+
+// Returns the cached plan for a power-of-two size, building it on first use
+const fft_plan &get_fft_plan(size_t size);
+
+// Magnitude spectrum of a real signal made of two consecutive spans. The
+// result matches the original FFT_analysis: out[k] = 2 * |X_k| / N truncated
+// to int, for all N bins. One engine per thread keeps the scratch buffers.
+class fft_engine {
+public:
+  fft_engine();
+
+  void magnitudes(const sample_span &first, const sample_span &second,
+                  int *out);
+
+private:
+  const fft_plan &plan_for(size_t size);
+
+  typedef void (*stage_fn)(double *re, double *im, const double *tw_re,
+                           const double *tw_im, size_t half, size_t h);
+
+  stage_fn MStage;
+  std::unordered_map<size_t, const fft_plan *> MPlans;
+  std::vector<double> MRe;
+  std::vector<double> MIm;
+};
+
+#endif /* __FFT_HPP__ */
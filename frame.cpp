@@ -0,0 +1,188 @@
+#include "frame.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+const size_t MIN_READ_SIZE = 4096;
+
+ssize_t write_frame(int fd, const char *data, size_t size) {
+  uint32_t header = htonl(size);
+  struct iovec iov[2];
+  iov[0].iov_base = &header;
+  iov[0].iov_len = FRAME_HEADER_SIZE;
+  iov[1].iov_base = const_cast<char *>(data);
+  iov[1].iov_len = size;
+  return writev(fd, iov, 2);
+}
+
+size_t frame_reader::pending_frame_size() const {
+  if (MEnd - MBegin < FRAME_HEADER_SIZE)
+    return 0;
+  uint32_t header;
+  memcpy(&header, MBuffer.data() + MBegin, FRAME_HEADER_SIZE);
+  return FRAME_HEADER_SIZE + ntohl(header);
+}
+
+ssize_t frame_reader::read_some(int fd) {
+  if (MBegin == MEnd) {
+    MBegin = MEnd = 0;
+  } else if (MBegin > 0 && MBuffer.size() - MEnd < MIN_READ_SIZE) {
+    // only the tail of a partial frame is left, move it to the front
+    memmove(MBuffer.data(), MBuffer.data() + MBegin, MEnd - MBegin);
+    MEnd -= MBegin;
+    MBegin = 0;
+  }
+
+  // Once the header is known, make room for the whole frame, so that a large
+  // payload is read straight into place
+  size_t frame_size = pending_frame_size();
+  if (frame_size > FRAME_HEADER_SIZE + MAX_FRAME_SIZE)
+    frame_size = 0;
+  size_t wanted = std::max(MEnd + MIN_READ_SIZE, MBegin + frame_size);
+  if (MBuffer.size() < wanted)
+    MBuffer.resize(std::max(wanted, MBuffer.size() * 2));
+
+  ssize_t nbytes = read(fd, MBuffer.data() + MEnd, MBuffer.size() - MEnd);
+  if (nbytes > 0) {
+    MEnd += nbytes;
+    mark_received(clock::now());
+  }
+  return nbytes;
+}
+
+void frame_reader::mark_received(clock::time_point received) {
+  MMarks.push_back({MConsumed + (MEnd - MBegin), received});
+}
+
+bool frame_reader::next_frame(const char *&data, size_t &size) {
+  clock::time_point received;
+  return next_frame(data, size, received);
+}
+
+bool frame_reader::next_frame(const char *&data, size_t &size,
+                              clock::time_point &received) {
+  size_t frame_size = pending_frame_size();
+  if (frame_size == 0)
+    return false;
+  if (frame_size - FRAME_HEADER_SIZE > MAX_FRAME_SIZE) {
+    MBroken = true;
+    return false;
+  }
+  if (MEnd - MBegin < frame_size)
+    return false;
+
+  data = MBuffer.data() + MBegin + FRAME_HEADER_SIZE;
+  size = frame_size - FRAME_HEADER_SIZE;
+  MBegin += frame_size;
+  MConsumed += frame_size;
+
+  // the frame is complete with the first read that reaches its end
+  while (MMarks.front().end < MConsumed)
+    MMarks.pop_front();
+  received = MMarks.front().received;
+  if (MMarks.front().end == MConsumed)
+    MMarks.pop_front();
+  return true;
+}
+
+bool frame_reader::partial_frame(const char *&data, size_t &size) const {
+  size_t frame_size = pending_frame_size();
+  if (frame_size == 0 || frame_size - FRAME_HEADER_SIZE > MAX_FRAME_SIZE)
+    return false;
+  data = MBuffer.data() + MBegin + FRAME_HEADER_SIZE;
+  size = std::min(MEnd - MBegin, frame_size) - FRAME_HEADER_SIZE;
+  return true;
+}
+
+void frame_reader::append(const char *data, size_t size,
+                          clock::time_point received) {
+  if (MBegin == MEnd) {
+    MBegin = MEnd = 0;
+  } else if (MBegin > 0 && MBuffer.size() - MEnd < size) {
+    memmove(MBuffer.data(), MBuffer.data() + MBegin, MEnd - MBegin);
+    MEnd -= MBegin;
+    MBegin = 0;
+  }
+  if (MBuffer.size() - MEnd < size)
+    MBuffer.resize(std::max(MEnd + size, MBuffer.size() * 2));
+  memcpy(MBuffer.data() + MEnd, data, size);
+  MEnd += size;
+  mark_received(received);
+}
+
+void frame_writer::push(std::string payload) {
+  MPendingBytes += FRAME_HEADER_SIZE + payload.size();
+  MFrames.push_back({htonl(payload.size()), std::move(payload), false});
+}
+
+void frame_writer::push_raw(std::string data) {
+  MPendingBytes += data.size();
+  MFrames.push_back({0, std::move(data), true});
+}
+
+int frame_writer::prepare(struct iovec *iov, int max_iov) const {
+  int iovcnt = 0;
+  size_t skip = MOffset;
+  for (auto it = MFrames.begin(); it != MFrames.end() && iovcnt + 2 <= max_iov;
+       ++it) {
+    if (skip < it->header_size()) {
+      iov[iovcnt].iov_base =
+          const_cast<char *>(reinterpret_cast<const char *>(&it->header)) +
+          skip;
+      iov[iovcnt].iov_len = it->header_size() - skip;
+      ++iovcnt;
+      skip = 0;
+    } else {
+      skip -= it->header_size();
+    }
+    if (skip < it->payload.size()) {
+      iov[iovcnt].iov_base = const_cast<char *>(it->payload.data()) + skip;
+      iov[iovcnt].iov_len = it->payload.size() - skip;
+      ++iovcnt;
+    }
+    skip = 0;
+  }
+  return iovcnt;
+}
+
+bool frame_writer::flush(int fd) {
+  while (!MFrames.empty()) {
+    struct iovec iov[MAX_WRITE_IOV];
+    int iovcnt = prepare(iov, MAX_WRITE_IOV);
+
+    // MSG_NOSIGNAL: a peer that reset the connection fails the call with
+    // EPIPE instead of killing the process with SIGPIPE
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    ssize_t nbytes = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (nbytes == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    consume(nbytes);
+  }
+  return true;
+}
+
+void frame_writer::consume(size_t nbytes) {
+  MPendingBytes -= nbytes;
+  while (nbytes > 0) {
+    const queued_frame &front = MFrames.front();
+    size_t left = front.header_size() + front.payload.size() - MOffset;
+    if (nbytes < left) {
+      MOffset += nbytes;
+      return;
+    }
+    nbytes -= left;
+    MFrames.pop_front();
+    MOffset = 0;
+  }
+}
@@ -0,0 +1,114 @@
+#ifndef __FRAME_HPP__
+#define __FRAME_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+// Every message on the wire is a frame: a 4-byte big-endian payload length
+// followed by the payload itself.
+const size_t FRAME_HEADER_SIZE = sizeof(uint32_t);
+const size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+// iovecs of one write, header and payload of up to 32 frames
+const int MAX_WRITE_IOV = 64;
+
+// Sends header and payload with a single writev(), without joining them.
+ssize_t write_frame(int fd, const char *data, size_t size);
+
+// Per-connection input buffer. It keeps partial frames across wakeups and
+// hands out every complete frame in place, without copying the payload.
+class frame_reader {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  // One read() into the buffer tail, returns like read() does
+  ssize_t read_some(int fd);
+
+  // Copies input that was received elsewhere, e.g. by io_uring, to the tail
+  void append(const char *data, size_t size, clock::time_point received);
+
+  // Points data/size at the next complete payload. The pointer stays valid
+  // until the next read_some() call.
+  bool next_frame(const char *&data, size_t &size);
+
+  // Same, received tells when the frame's last byte was read
+  bool next_frame(const char *&data, size_t &size,
+                  clock::time_point &received);
+
+  // Points data/size at the part of the next payload received so far, so
+  // it can be consumed before the frame is complete. False until its header
+  // has arrived.
+  bool partial_frame(const char *&data, size_t &size) const;
+
+  // The peer announced a frame larger than MAX_FRAME_SIZE
+  inline bool is_broken() const { return MBroken; }
+
+private:
+  size_t pending_frame_size() const;
+
+  // remembers when the input up to MEnd arrived
+  void mark_received(clock::time_point received);
+
+  // when the input up to a stream offset arrived
+  struct read_mark {
+    uint64_t end;
+    clock::time_point received;
+  };
+
+  std::vector<char> MBuffer;
+  size_t MBegin = 0;
+  size_t MEnd = 0;
+  // stream offset of MBegin
+  uint64_t MConsumed = 0;
+  // one per read that isn't fully consumed yet, oldest first
+  std::deque<read_mark> MMarks;
+  bool MBroken = false;
+};
+
+// Per-connection output queue. Frames that could not be written right away
+// stay queued and go out later, several of them per sendmsg() call.
+class frame_writer {
+public:
+  void push(std::string payload);
+
+  // Queues bytes as they are, without a frame header, e.g. a text reply
+  void push_raw(std::string data);
+
+  // Writes as much as the socket accepts. Returns false on a write error,
+  // EAGAIN just leaves the rest queued. fd must be a socket.
+  bool flush(int fd);
+
+  inline bool empty() const { return MFrames.empty(); }
+
+  inline size_t pending_bytes() const { return MPendingBytes; }
+
+  // Fills iov with the queued output, at most max_iov entries. The memory
+  // stays valid until consume() drops it, frames pushed meanwhile don't
+  // move it.
+  int prepare(struct iovec *iov, int max_iov) const;
+
+  // Drops nbytes that were written
+  void consume(size_t nbytes);
+
+private:
+  struct queued_frame {
+    uint32_t header;
+    std::string payload;
+    // no header goes out in front of the payload
+    bool raw;
+
+    inline size_t header_size() const { return raw ? 0 : FRAME_HEADER_SIZE; }
+  };
+
+  std::deque<queued_frame> MFrames;
+  // bytes of the front frame, header included, that are already written
+  size_t MOffset = 0;
+  size_t MPendingBytes = 0;
+};
+
+#endif /* __FRAME_HPP__ */
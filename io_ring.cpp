@@ -0,0 +1,218 @@
+#include "io_ring.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+static int io_uring_setup(unsigned entries, io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags, void *arg, size_t arg_size) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg,
+                 arg_size);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg,
+                             unsigned nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+io_ring::~io_ring() {
+  if (MBufRing)
+    munmap(MBufRing, MBufRingSize);
+  if (MBuffers)
+    munmap(MBuffers, MBuffersSize);
+  if (MSqes)
+    munmap(MSqes, MSqesSize);
+  if (MCqRing && MCqRing != MSqRing)
+    munmap(MCqRing, MCqRingSize);
+  if (MSqRing)
+    munmap(MSqRing, MSqRingSize);
+  if (MFd != -1)
+    close(MFd);
+}
+
+bool io_ring::init(unsigned entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  // only the owning thread submits, completions are run when it enters
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+  MFd = io_uring_setup(entries, &params);
+  if (MFd == -1 && errno == EINVAL) {
+    // kernels before 6.0 know neither flag
+    memset(&params, 0, sizeof(params));
+    MFd = io_uring_setup(entries, &params);
+  }
+  if (MFd == -1)
+    return false;
+
+  MSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  MCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap)
+    MSqRingSize = MCqRingSize = std::max(MSqRingSize, MCqRingSize);
+
+  MSqRing = mmap(nullptr, MSqRingSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, MFd, IORING_OFF_SQ_RING);
+  if (MSqRing == MAP_FAILED) {
+    MSqRing = nullptr;
+    return false;
+  }
+  if (single_mmap) {
+    MCqRing = MSqRing;
+  } else {
+    MCqRing = mmap(nullptr, MCqRingSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, MFd, IORING_OFF_CQ_RING);
+    if (MCqRing == MAP_FAILED) {
+      MCqRing = nullptr;
+      return false;
+    }
+  }
+  MSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, MSqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, MFd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    return false;
+  MSqes = static_cast<io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(MSqRing);
+  MSqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  MSqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  MSqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  MSqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  MSqEntries = params.sq_entries;
+
+  char *cq = static_cast<char *>(MCqRing);
+  MCqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  MCqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  MCqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  MCqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+
+  // kernels before 5.6 have no probe, they count as supporting nothing
+  const unsigned max_ops = 256;
+  std::vector<char> probe_buffer(sizeof(io_uring_probe) +
+                                 max_ops * sizeof(io_uring_probe_op));
+  auto *probe = reinterpret_cast<io_uring_probe *>(probe_buffer.data());
+  if (io_uring_register(MFd, IORING_REGISTER_PROBE, probe, max_ops) == 0) {
+    for (unsigned op = 0; op <= probe->last_op && op < max_ops; ++op)
+      MOpcodes[op] = probe->ops[op].flags & IO_URING_OP_SUPPORTED;
+  }
+  return true;
+}
+
+bool io_ring::supports_multishot_recv(uint16_t group) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+    return false;
+  // at end of file the recv completes right away and takes no buffer
+  shutdown(fds[1], SHUT_WR);
+
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fds[0];
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = group;
+  int res = -EINVAL;
+  if (submit_and_wait(1, 1000) >= 0)
+    for_each_cqe([&](const io_uring_cqe &cqe) { res = cqe.res; });
+
+  close(fds[0]);
+  close(fds[1]);
+  return res >= 0;
+}
+
+io_uring_sqe *io_ring::get_sqe() {
+  unsigned tail = *MSqTail;
+  if (tail - __atomic_load_n(MSqHead, __ATOMIC_ACQUIRE) == MSqEntries)
+    submit_and_wait(0);
+
+  unsigned index = tail & MSqMask;
+  io_uring_sqe *sqe = &MSqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  MSqArray[index] = index;
+  __atomic_store_n(MSqTail, tail + 1, __ATOMIC_RELEASE);
+  ++MToSubmit;
+  return sqe;
+}
+
+int io_ring::submit_and_wait(unsigned wait_nr, int timeout_ms) {
+  unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+  if (MToSubmit == 0 && wait_nr == 0)
+    return 0;
+
+  // the timeout goes along with the wait, no timeout SQE is needed
+  __kernel_timespec ts;
+  io_uring_getevents_arg arg;
+  void *argp = nullptr;
+  size_t arg_size = 0;
+  if (wait_nr && timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    argp = &arg;
+    arg_size = sizeof(arg);
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+
+  while (true) {
+    ++MSyscalls;
+    int res = io_uring_enter(MFd, MToSubmit, wait_nr, flags, argp, arg_size);
+    if (res >= 0) {
+      MToSubmit -= std::min<unsigned>(MToSubmit, res);
+      return res;
+    }
+    if (errno == ETIME)
+      return 0;
+    if (errno != EINTR)
+      return -1;
+  }
+}
+
+bool io_ring::setup_buffers(uint16_t group, unsigned count, unsigned size) {
+  MBufRingSize = count * sizeof(io_uring_buf);
+  void *ring = mmap(nullptr, MBufRingSize, PROT_READ | PROT_WRITE,
+                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (ring == MAP_FAILED)
+    return false;
+  MBufRing = static_cast<io_uring_buf_ring *>(ring);
+
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(MBufRing);
+  reg.ring_entries = count;
+  reg.bgid = group;
+  if (io_uring_register(MFd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    return false;
+
+  MBufferSize = size;
+  MBuffersSize = size_t(count) * size;
+  void *buffers = mmap(nullptr, MBuffersSize, PROT_READ | PROT_WRITE,
+                       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (buffers == MAP_FAILED)
+    return false;
+  MBuffers = static_cast<char *>(buffers);
+  MBufMask = count - 1;
+  for (unsigned bid = 0; bid < count; ++bid)
+    recycle_buffer(bid);
+  return true;
+}
+
+void io_ring::recycle_buffer(uint16_t bid) {
+  // In C++ the header's flexible bufs[] doesn't start at offset 0 (its
+  // empty placeholder struct takes a byte), so index the entries directly
+  io_uring_buf *bufs = reinterpret_cast<io_uring_buf *>(MBufRing);
+  uint16_t tail = MBufRing->tail;
+  io_uring_buf &buf = bufs[tail & MBufMask];
+  buf.addr = reinterpret_cast<uint64_t>(buffer(bid));
+  buf.len = MBufferSize;
+  buf.bid = bid;
+  __atomic_store_n(&MBufRing->tail, uint16_t(tail + 1), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,102 @@
+#ifndef __IO_RING_HPP__
+#define __IO_RING_HPP__
+
+#include <bitset>
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Thin io_uring wrapper on the raw syscalls, so the server needs no
+// liburing. One ring belongs to one thread. Submissions are only queued by
+// get_sqe(), submit_and_wait() hands all of them to the kernel and waits
+// for completions with a single io_uring_enter().
+class io_ring {
+public:
+  io_ring() = default;
+
+  ~io_ring();
+
+  io_ring(const io_ring &) = delete;
+  io_ring &operator=(const io_ring &) = delete;
+
+  // False if the kernel has no (usable) io_uring, errno tells why
+  bool init(unsigned entries);
+
+  // Whether the kernel knows the opcode. Flags of an opcode, like multishot,
+  // came later than the opcode itself and need a test of their own.
+  inline bool supports(uint8_t opcode) const { return MOpcodes[opcode]; }
+
+  // Runs a multishot recv from group on a socketpair, kernels before 6.0
+  // fail it with -EINVAL. Call it before anything else is submitted.
+  bool supports_multishot_recv(uint16_t group);
+
+  // A zeroed SQE. A full submission queue is flushed to the kernel first.
+  io_uring_sqe *get_sqe();
+
+  // Submits what's queued and waits for at least wait_nr completions, or
+  // until timeout_ms passed when it's not -1. Returns the io_uring_enter()
+  // result, -1 with errno on failure.
+  int submit_and_wait(unsigned wait_nr, int timeout_ms = -1);
+
+  // Calls fn(const io_uring_cqe &) for every completion that is ready and
+  // returns how many there were
+  template <class Fn> unsigned for_each_cqe(Fn &&fn) {
+    unsigned head = *MCqHead;
+    unsigned tail = __atomic_load_n(MCqTail, __ATOMIC_ACQUIRE);
+    unsigned count = tail - head;
+    for (; head != tail; ++head)
+      fn(MCqes[head & MCqMask]);
+    __atomic_store_n(MCqHead, head, __ATOMIC_RELEASE);
+    return count;
+  }
+
+  // Registers count buffers of size bytes each as provided buffer group
+  // group, for recv with IOSQE_BUFFER_SELECT
+  bool setup_buffers(uint16_t group, unsigned count, unsigned size);
+
+  inline char *buffer(uint16_t bid) const {
+    return MBuffers + size_t(bid) * MBufferSize;
+  }
+
+  // Gives a buffer the kernel filled back to the group
+  void recycle_buffer(uint16_t bid);
+
+  // io_uring_enter() calls made so far
+  inline uint64_t syscalls() const { return MSyscalls; }
+
+private:
+  int MFd = -1;
+
+  void *MSqRing = nullptr;
+  size_t MSqRingSize = 0;
+  void *MCqRing = nullptr;
+  size_t MCqRingSize = 0;
+  io_uring_sqe *MSqes = nullptr;
+  size_t MSqesSize = 0;
+
+  unsigned *MSqHead = nullptr;
+  unsigned *MSqTail = nullptr;
+  unsigned *MSqArray = nullptr;
+  unsigned MSqMask = 0;
+  unsigned MSqEntries = 0;
+  // SQEs queued since the last io_uring_enter()
+  unsigned MToSubmit = 0;
+
+  unsigned *MCqHead = nullptr;
+  unsigned *MCqTail = nullptr;
+  io_uring_cqe *MCqes = nullptr;
+  unsigned MCqMask = 0;
+
+  io_uring_buf_ring *MBufRing = nullptr;
+  size_t MBufRingSize = 0;
+  unsigned MBufMask = 0;
+  char *MBuffers = nullptr;
+  size_t MBuffersSize = 0;
+  unsigned MBufferSize = 0;
+
+  uint64_t MSyscalls = 0;
+  // from IORING_REGISTER_PROBE, empty if the kernel can't tell
+  std::bitset<256> MOpcodes;
+};
+
+#endif /* __IO_RING_HPP__ */
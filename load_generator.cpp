@@ -0,0 +1,262 @@
+#include "load_generator.hpp"
+#include "connection.hpp"
+#include "read_json.hpp"
+#include <algorithm>
+#include <iostream>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <syslog.h>
+
+const int MAX_EVENTS = 256;
+// distinct random batches per profile, encoded once before the run
+const size_t PAYLOADS_PER_PROFILE = 16;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+load_generator::load_generator(client &source, size_t num_connections)
+    : MSource(source), MNumConnections(std::max<size_t>(1, num_connections)) {
+  auto cfg = MSource.config().get_object();
+  if (auto *val = cfg.if_contains("duration_s"))
+    MDuration = std::chrono::seconds(val->as_int64());
+  read_profiles();
+}
+
+void load_generator::read_profiles() {
+  auto cfg = MSource.config().get_object();
+  json::array profiles;
+  if (auto *val = cfg.if_contains("load_profiles")) {
+    profiles = val->as_array();
+  } else {
+    json::object profile;
+    profile["messages_per_second"] = 1.0;
+    profile["rate_of_metrics"] = cfg["rate_of_metrics"];
+    profile["mask_of_metrics"] = cfg["mask_of_metrics"];
+    profiles.push_back(std::move(profile));
+  }
+
+  for (auto &elem : profiles) {
+    auto obj = elem.as_object();
+    load_profile profile;
+    profile.messages_per_second = obj["messages_per_second"].to_number<double>();
+    const int rate_of_metrics = obj["rate_of_metrics"].to_number<int>();
+    const auto &metrics = obj["mask_of_metrics"].as_array();
+    for (size_t i = 0; i < PAYLOADS_PER_PROFILE; ++i) {
+      std::string payload;
+      MSource.encode_request(
+          payload, MSource.collect_metrics_from_sensors(metrics,
+                                                        rate_of_metrics));
+      profile.payloads.push_back(std::move(payload));
+    }
+    MProfiles.push_back(std::move(profile));
+  }
+}
+
+void load_generator::open_connections() {
+  auto start_time = clock::now();
+  for (size_t i = 0; i < MNumConnections; ++i) {
+    int fd = MSource.open_connection();
+    set_nonblocking(fd);
+    epoll_ctl_add(MEpollFd, fd, EPOLLIN);
+
+    auto &conn = MConnections[fd];
+    conn.profile = i % MProfiles.size();
+    conn.interval = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(
+            1.0 / MProfiles[conn.profile].messages_per_second));
+    conn.events = EPOLLIN;
+
+    // spread the first sends evenly over one interval
+    MSchedule.emplace(start_time + conn.interval * i / MNumConnections, fd);
+  }
+}
+
+bool load_generator::run() {
+  signal(SIGINT, [](int) { stop_requested = 1; });
+  signal(SIGTERM, [](int) { stop_requested = 1; });
+  signal(SIGPIPE, SIG_IGN);
+
+  MEpollFd = epoll_create1(0);
+  if (MEpollFd == -1) {
+    perror("epoll_create1 failed");
+    return false;
+  }
+  open_connections();
+
+  auto start_time = clock::now();
+  auto end_time = start_time + MDuration;
+  auto next_progress = start_time + std::chrono::seconds(1);
+
+  struct epoll_event events[MAX_EVENTS];
+  while (!stop_requested && !MConnections.empty()) {
+    auto now = clock::now();
+    if (now >= end_time)
+      break;
+    if (now >= next_progress) {
+      print_progress(now - start_time);
+      next_progress += std::chrono::seconds(1);
+    }
+
+    // everything that is due goes out now, however late it is
+    while (!MSchedule.empty() && MSchedule.top().first <= now) {
+      auto scheduled = MSchedule.top();
+      MSchedule.pop();
+      auto it = MConnections.find(scheduled.second);
+      if (it == MConnections.end())
+        continue;
+      // a failed send closes the connection and erases it
+      int fd = it->first;
+      auto interval = it->second.interval;
+      if (send_request(fd, it->second, scheduled.first))
+        MSchedule.emplace(scheduled.first + interval, fd);
+    }
+
+    auto wake_up = std::min(end_time, next_progress);
+    if (!MSchedule.empty())
+      wake_up = std::min(wake_up, MSchedule.top().first);
+    auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+        wake_up - clock::now());
+    int event_count = epoll_wait(MEpollFd, events, MAX_EVENTS,
+                                 std::max<int64_t>(0, timeout.count()));
+    if (event_count == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait() failed");
+      return false;
+    }
+
+    for (int i = 0; i < event_count; ++i) {
+      int fd = events[i].data.fd;
+      auto it = MConnections.find(fd);
+      if (it == MConnections.end())
+        continue;
+      auto &conn = it->second;
+
+      bool alive = true;
+      if (events[i].events & EPOLLOUT)
+        alive = conn.writer.flush(fd);
+      if (alive && (events[i].events & EPOLLIN))
+        alive = receive_responses(fd, conn);
+      if (!alive || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+        close_connection(fd);
+        continue;
+      }
+      update_interest(fd, conn);
+    }
+  }
+
+  print_report(clock::now() - start_time);
+  for (auto &elem : MConnections)
+    close(elem.first);
+  MConnections.clear();
+  close(MEpollFd);
+  return true;
+}
+
+bool load_generator::send_request(int fd, connection &conn,
+                                  clock::time_point scheduled) {
+  const auto &payloads = MProfiles[conn.profile].payloads;
+  const auto &payload = payloads[conn.next_payload++ % payloads.size()];
+  conn.writer.push(payload);
+  conn.in_flight.push_back(scheduled);
+  ++MSent;
+  MBytesSent += payload.size();
+
+  if (!conn.writer.flush(fd)) {
+    close_connection(fd);
+    return false;
+  }
+  update_interest(fd, conn);
+  return true;
+}
+
+bool load_generator::receive_responses(int fd, connection &conn) {
+  while (true) {
+    const char *data;
+    size_t size;
+    while (conn.reader.next_frame(data, size)) {
+      auto now = clock::now();
+      if (conn.in_flight.empty()) {
+        syslog(LOG_ERR, "Unexpected response on connection %d", fd);
+        return false;
+      }
+      MLatencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               now - conn.in_flight.front())
+                               .count());
+      conn.in_flight.pop_front();
+      ++MReceived;
+      if (is_error_response(data, size))
+        ++MRejected;
+    }
+    if (conn.reader.is_broken())
+      return false;
+
+    ssize_t nbytes = conn.reader.read_some(fd);
+    if (nbytes == -1)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (nbytes == 0)
+      return false;
+  }
+}
+
+void load_generator::close_connection(int fd) {
+  epoll_ctl(MEpollFd, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+  MConnections.erase(fd);
+  ++MClosed;
+}
+
+void load_generator::update_interest(int fd, connection &conn) {
+  uint32_t events = EPOLLIN;
+  if (!conn.writer.empty())
+    events |= EPOLLOUT;
+  if (events != conn.events) {
+    epoll_ctl_mod(MEpollFd, fd, events);
+    conn.events = events;
+  }
+}
+
+void load_generator::print_progress(clock::duration elapsed) {
+  uint64_t in_flight = 0;
+  for (auto &elem : MConnections)
+    in_flight += elem.second.in_flight.size();
+  std::cerr << std::chrono::duration_cast<std::chrono::seconds>(elapsed).count()
+            << "s: sent " << MSent - MLastSent << "/s, received "
+            << MReceived - MLastReceived << "/s, in flight " << in_flight
+            << ", connections " << MConnections.size() << std::endl;
+  MLastSent = MSent;
+  MLastReceived = MReceived;
+}
+
+void load_generator::print_report(clock::duration elapsed) {
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  std::sort(MLatencies.begin(), MLatencies.end());
+  auto percentile_us = [this](double fraction) -> double {
+    if (MLatencies.empty())
+      return 0;
+    size_t rank = std::min(MLatencies.size() - 1,
+                           size_t(fraction * MLatencies.size()));
+    return MLatencies[rank] / 1000.0;
+  };
+
+  json::object latency;
+  latency["p50_us"] = percentile_us(0.5);
+  latency["p99_us"] = percentile_us(0.99);
+  latency["p999_us"] = percentile_us(0.999);
+  latency["max_us"] = MLatencies.empty() ? 0.0 : MLatencies.back() / 1000.0;
+
+  json::object report;
+  report["connections"] = MNumConnections;
+  report["connections_lost"] = MClosed;
+  report["duration_s"] = seconds;
+  report["sent"] = MSent;
+  report["received"] = MReceived;
+  report["rejected"] = MRejected;
+  report["unanswered"] = MSent - MReceived;
+  report["requests_per_second"] = seconds > 0 ? MReceived / seconds : 0.0;
+  report["bytes_sent"] = MBytesSent;
+  report["latency"] = std::move(latency);
+
+  std::stringstream ss;
+  pretty_print(ss, report);
+  std::cout << ss.str() << std::endl;
+}
@@ -0,0 +1,90 @@
+#ifndef __LOAD_GENERATOR_HPP__
+#define __LOAD_GENERATOR_HPP__
+
+#include "client.hpp"
+#include "frame.hpp"
+#include <chrono>
+#include <deque>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Send rate and metrics of a group of simulated sensors. Profiles come from
+// "load_profiles" in the client config and are assigned to the connections
+// round-robin. Without it the top-level rate_of_metrics and
+// mask_of_metrics make the only profile, sending once per second.
+struct load_profile {
+  double messages_per_second;
+  // pre-encoded batches the connections of the profile send in turn
+  std::vector<std::string> payloads;
+};
+
+// Many simulated clients on one epoll loop. The load is open-loop: every
+// connection sends on its own fixed schedule whether or not the server has
+// answered, and latency is measured from the scheduled send time, so a slow
+// server shows up in the percentiles instead of slowing the senders down.
+class load_generator {
+public:
+  load_generator(client &source, size_t num_connections);
+
+  bool run();
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  struct connection {
+    size_t profile;
+    clock::duration interval;
+    size_t next_payload = 0;
+    // scheduled send times of the requests still waiting for a response,
+    // the server answers every request of a connection in order
+    std::deque<clock::time_point> in_flight;
+    frame_reader reader;
+    frame_writer writer;
+    uint32_t events = 0;
+  };
+
+  typedef std::pair<clock::time_point, int> scheduled_send;
+
+  void read_profiles();
+
+  void open_connections();
+
+  // False if the send failed, the connection is closed and conn is gone
+  bool send_request(int fd, connection &conn, clock::time_point scheduled);
+
+  bool receive_responses(int fd, connection &conn);
+
+  void close_connection(int fd);
+
+  void update_interest(int fd, connection &conn);
+
+  void print_progress(clock::duration elapsed);
+
+  void print_report(clock::duration elapsed);
+
+  client &MSource;
+  size_t MNumConnections;
+  std::chrono::seconds MDuration{60};
+  std::vector<load_profile> MProfiles;
+
+  int MEpollFd = -1;
+  std::unordered_map<int, connection> MConnections;
+  std::priority_queue<scheduled_send, std::vector<scheduled_send>,
+                      std::greater<scheduled_send>>
+      MSchedule;
+
+  uint64_t MSent = 0;
+  uint64_t MReceived = 0;
+  // responses that were errors, they count as received
+  uint64_t MRejected = 0;
+  uint64_t MBytesSent = 0;
+  uint64_t MClosed = 0;
+  uint64_t MLastSent = 0;
+  uint64_t MLastReceived = 0;
+  // request-to-response latencies in nanoseconds
+  std::vector<uint64_t> MLatencies;
+};
+
+#endif /* __LOAD_GENERATOR_HPP__ */
@@ -0,0 +1,221 @@
+#include "metric_scanner.hpp"
+#include <stdint.h>
+#include <string.h>
+
+const size_t MAX_SKIP_DEPTH = 64;
+
+namespace {
+
+class scanner {
+public:
+  scanner(const char *data, size_t size) : MPos(data), MEnd(data + size) {}
+
+  bool at_end() {
+    skip_whitespace();
+    return MPos == MEnd;
+  }
+
+  // Consumes c, after any whitespace
+  bool take(char c) {
+    skip_whitespace();
+    if (MPos == MEnd || *MPos != c)
+      return false;
+    ++MPos;
+    return true;
+  }
+
+  bool peek(char c) {
+    skip_whitespace();
+    return MPos != MEnd && *MPos == c;
+  }
+
+  // Reads a string without unescaping it, the result points into the input
+  bool string(const char *&str, size_t &len) {
+    if (!take('"'))
+      return false;
+    str = MPos;
+    while (MPos != MEnd && *MPos != '"') {
+      if (static_cast<unsigned char>(*MPos) < 0x20)
+        return false;
+      if (*MPos == '\\' && ++MPos == MEnd)
+        return false;
+      ++MPos;
+    }
+    if (MPos == MEnd)
+      return false;
+    len = MPos - str;
+    ++MPos;
+    return true;
+  }
+
+  // An integer in the int64 range; fractions and exponents are rejected
+  bool integer(int64_t &value) {
+    skip_whitespace();
+    bool negative = MPos != MEnd && *MPos == '-';
+    if (negative)
+      ++MPos;
+    const char *digits = MPos;
+    uint64_t magnitude = 0;
+    while (MPos != MEnd && unsigned(*MPos - '0') < 10) {
+      unsigned digit = *MPos - '0';
+      if (magnitude > (UINT64_MAX - digit) / 10)
+        return false;
+      magnitude = magnitude * 10 + digit;
+      ++MPos;
+    }
+    if (MPos == digits || (*digits == '0' && MPos - digits > 1))
+      return false;
+    if (MPos != MEnd && (*MPos == '.' || *MPos == 'e' || *MPos == 'E'))
+      return false;
+
+    const uint64_t limit = uint64_t(INT64_MAX) + negative;
+    if (magnitude > limit)
+      return false;
+    value = negative ? int64_t(0 - magnitude) : int64_t(magnitude);
+    return true;
+  }
+
+  // Skips any JSON value. Nesting deeper than MAX_SKIP_DEPTH is rejected,
+  // which keeps the container stack on the stack.
+  bool skip_value() {
+    bool is_object[MAX_SKIP_DEPTH];
+    size_t depth = 0;
+    while (true) {
+      skip_whitespace();
+      if (MPos == MEnd)
+        return false;
+      char c = *MPos;
+      if (c == '{' || c == '[') {
+        if (depth == MAX_SKIP_DEPTH)
+          return false;
+        ++MPos;
+        is_object[depth++] = c == '{';
+        if (!take(c == '{' ? '}' : ']')) {
+          if (c == '{' && !key())
+            return false;
+          continue;
+        }
+        --depth;
+      } else if (c == '"') {
+        const char *str;
+        size_t len;
+        if (!string(str, len))
+          return false;
+      } else if (c == '-' || unsigned(c - '0') < 10) {
+        skip_number();
+      } else if (!literal("true") && !literal("false") && !literal("null")) {
+        return false;
+      }
+
+      // after a value: the next element, or the end of the container
+      while (true) {
+        if (depth == 0)
+          return true;
+        if (take(',')) {
+          if (is_object[depth - 1] && !key())
+            return false;
+          break;
+        }
+        if (!take(is_object[depth - 1] ? '}' : ']'))
+          return false;
+        --depth;
+      }
+    }
+  }
+
+private:
+  void skip_whitespace() {
+    while (MPos != MEnd &&
+           (*MPos == ' ' || *MPos == '\n' || *MPos == '\r' || *MPos == '\t'))
+      ++MPos;
+  }
+
+  void skip_number() {
+    while (MPos != MEnd && (unsigned(*MPos - '0') < 10 || *MPos == '-' ||
+                            *MPos == '+' || *MPos == '.' || *MPos == 'e' ||
+                            *MPos == 'E'))
+      ++MPos;
+  }
+
+  bool literal(const char *word) {
+    size_t len = strlen(word);
+    if (size_t(MEnd - MPos) < len || memcmp(MPos, word, len) != 0)
+      return false;
+    MPos += len;
+    return true;
+  }
+
+  bool key() {
+    const char *str;
+    size_t len;
+    return string(str, len) && take(':');
+  }
+
+  const char *MPos;
+  const char *MEnd;
+};
+
+} // namespace
+
+static bool is_key(const char *str, size_t len, const char *name) {
+  return len == strlen(name) && memcmp(str, name, len) == 0;
+}
+
+bool scan_metrics_json(const char *data, size_t size, metric_batch &batch) {
+  batch.metrics.clear();
+  batch.samples.clear();
+
+  scanner in(data, size);
+  if (!in.take('['))
+    return false;
+  if (in.take(']'))
+    return in.at_end();
+
+  do {
+    if (!in.take('{'))
+      return false;
+    scanned_metric metric = {0, 0, 0};
+    bool has_id = false, has_data = false;
+    if (!in.peek('}')) {
+      do {
+        const char *key;
+        size_t len;
+        if (!in.string(key, len) || !in.take(':'))
+          return false;
+
+        if (is_key(key, len, "_id")) {
+          int64_t idm;
+          if (!in.integer(idm))
+            return false;
+          metric.idm = idm;
+          has_id = true;
+        } else if (is_key(key, len, "data")) {
+          // a repeated key replaces the earlier samples, as in a DOM
+          batch.samples.resize(batch.samples.size() - metric.count);
+          metric.offset = batch.samples.size();
+          if (!in.take('['))
+            return false;
+          if (!in.take(']')) {
+            do {
+              int64_t sample;
+              if (!in.integer(sample))
+                return false;
+              batch.samples.push_back(sample);
+            } while (in.take(','));
+            if (!in.take(']'))
+              return false;
+          }
+          metric.count = batch.samples.size() - metric.offset;
+          has_data = true;
+        } else if (!in.skip_value()) {
+          return false;
+        }
+      } while (in.take(','));
+    }
+    if (!in.take('}') || !has_id || !has_data)
+      return false;
+    batch.metrics.push_back(metric);
+  } while (in.take(','));
+
+  return in.take(']') && in.at_end();
+}
@@ -0,0 +1,30 @@
+#ifndef __METRIC_SCANNER_HPP__
+#define __METRIC_SCANNER_HPP__
+
+#include <stddef.h>
+#include <vector>
+
+// One metric of a scanned message, its samples are
+// batch.samples[offset, offset + count)
+struct scanned_metric {
+  int idm;
+  size_t offset;
+  size_t count;
+};
+
+// Flat result of a scan. The vectors are meant to be reused between
+// messages, so a scan allocates nothing once they have grown.
+struct metric_batch {
+  std::vector<scanned_metric> metrics;
+  std::vector<int> samples;
+};
+
+// Hand-written scanner for the JSON metrics message
+//   [{"_id": <int>, "data": [<int>, ...]}, ...]
+// that goes straight from the text to the batch, without a DOM. Keys other
+// than _id and data are skipped, whatever their value. The whole message is
+// validated before anything is handed out, so a malformed one has no
+// effect: false is returned and the batch must be ignored.
+bool scan_metrics_json(const char *data, size_t size, metric_batch &batch);
+
+#endif /* __METRIC_SCANNER_HPP__ */
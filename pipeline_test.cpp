@@ -0,0 +1,209 @@
+#include "connection.hpp"
+#include "frame.hpp"
+#include "protocol.hpp"
+#include "read_json.hpp"
+#include "server.hpp"
+#include "server_stats.hpp"
+#include <arpa/inet.h>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+// End-to-end check that a pipelined client can match responses to requests
+// in order: a malformed batch in the middle of a pipeline is answered with an
+// error, and the batches around it still get their own scores. Runs an
+// in-process server with and without the worker pool. A third server checks
+// that requests queued behind slow ones are shed once over the latency
+// budget.
+const uint64_t TEST_PORT = 7300;
+
+static int failures = 0;
+
+static void check(bool condition, const std::string &what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+// extra_config is appended to the JSON object, e.g. ", \"key\": 1"
+static void start_server(uint64_t port, int num_workers,
+                         const std::string &extra_config =
+                             ", \"fft_window\": 1024") {
+  std::string path = "/tmp/pipeline_test_" + std::to_string(port) + ".cfg";
+  {
+    std::ofstream cfg(path);
+    cfg << "{\"listen_port\": " << port << ", \"number_of_threads\": 1, "
+        << "\"number_of_workers\": " << num_workers
+        << ", \"result_log\": \"none\"" << extra_config << "}";
+  }
+  // the server runs until the process exits
+  server *s = new server();
+  s->read_config(path);
+  std::thread(&server::run, s).detach();
+}
+
+static int connect_to(uint64_t port) {
+  struct sockaddr_in addr = {0};
+  set_sockaddr(&addr, port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    int fd = Socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+      return fd;
+    close(fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  perror("connect() failed");
+  exit(EXIT_FAILURE);
+}
+
+static std::string json_batch(int idm) {
+  return "[{\"_id\":" + std::to_string(idm) + ",\"data\":[1,2,3,4]}]";
+}
+
+static std::string binary_batch(int idm) {
+  std::string str;
+  encode_metrics(str, parse_string(json_batch(idm)));
+  return str;
+}
+
+static std::string large_binary_batch(int idm, size_t num_samples) {
+  std::string samples;
+  for (size_t i = 0; i < num_samples; ++i)
+    samples += (i ? "," : "") + std::to_string(i % 1000);
+  std::string str;
+  encode_metrics(str, parse_string("[{\"_id\":" + std::to_string(idm) +
+                                   ",\"data\":[" + samples + "]}]"));
+  return str;
+}
+
+static int json_score_id(const char *data, size_t size) {
+  json::value response = parse_string(data, size);
+  if (!response.is_array() || response.as_array().size() != 1)
+    return -1;
+  return response.as_array()[0].as_object().at("_id").as_int64();
+}
+
+static int binary_score_id(const char *data, size_t size) {
+  std::vector<metric_score> scores;
+  if (!decode_scores(data, size, scores) || scores.size() != 1)
+    return -1;
+  return scores[0].idm;
+}
+
+static void run_pipeline(uint64_t port, const std::string &name) {
+  // a record announcing more samples than the message holds
+  std::string truncated = binary_batch(4);
+  truncated.resize(truncated.size() - sizeof(int32_t));
+
+  frame_writer writer;
+  writer.push(json_batch(1));
+  writer.push("[{\"_id\":2,\"data\":[1,2");
+  writer.push(binary_batch(3));
+  writer.push(truncated);
+  writer.push(json_batch(5));
+
+  int fd = connect_to(port);
+  check(writer.flush(fd) && writer.empty(), name + ": sending the pipeline");
+  // a missing response fails the test instead of hanging it
+  struct timeval timeout = {5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  frame_reader reader;
+  std::vector<std::string> responses;
+  while (responses.size() < 5) {
+    const char *data;
+    size_t size;
+    if (reader.next_frame(data, size)) {
+      responses.emplace_back(data, size);
+      continue;
+    }
+    if (reader.read_some(fd) <= 0)
+      break;
+  }
+  close(fd);
+
+  check(responses.size() == 5, name + ": one response per request");
+  if (responses.size() != 5)
+    return;
+  auto &r = responses;
+  check(json_score_id(r[0].data(), r[0].size()) == 1,
+        name + ": scores of the first batch");
+  check(is_error_response(r[1].data(), r[1].size()),
+        name + ": error for the malformed JSON batch");
+  check(binary_score_id(r[2].data(), r[2].size()) == 3,
+        name + ": scores of the binary batch after it");
+  check(is_error_response(r[3].data(), r[3].size()) &&
+            detect_wire_format(r[3].data(), r[3].size()) ==
+                wire_format::binary,
+        name + ": binary error for the truncated binary batch");
+  check(json_score_id(r[4].data(), r[4].size()) == 5,
+        name + ": scores of the last batch");
+}
+
+static uint64_t shed_requests() {
+  return stats_snapshot()
+      .at("counters")
+      .as_object()
+      .at("shed_requests")
+      .to_number<uint64_t>();
+}
+
+// A pipeline read in one go but served one request per turn: every request
+// runs a large FFT, so the ones behind it wait for longer than the budget
+// even though each turn starts well within it.
+static void run_shedding(uint64_t port, const std::string &name) {
+  const int num_requests = 32;
+  frame_writer writer;
+  std::string batch = large_binary_batch(7, 4096);
+  for (int i = 0; i < num_requests; ++i)
+    writer.push(batch);
+
+  uint64_t shed_before = shed_requests();
+  int fd = connect_to(port);
+  check(writer.flush(fd) && writer.empty(), name + ": sending the pipeline");
+  struct timeval timeout = {5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  frame_reader reader;
+  int responses = 0;
+  while (responses < num_requests) {
+    const char *data;
+    size_t size;
+    if (reader.next_frame(data, size)) {
+      check(binary_score_id(data, size) == 7,
+            name + ": a shed request still gets its scores");
+      ++responses;
+      continue;
+    }
+    if (reader.read_some(fd) <= 0)
+      break;
+  }
+  close(fd);
+
+  check(responses == num_requests, name + ": one response per request");
+  check(shed_requests() > shed_before,
+        name + ": requests queued behind slow ones are shed");
+}
+
+int main() {
+  start_server(TEST_PORT, 0);
+  start_server(TEST_PORT + 1, 2);
+  start_server(TEST_PORT + 2, 0,
+               ", \"fft_window\": 65536, \"max_messages_per_turn\": 1, "
+               "\"latency_budget_ms\": 2");
+  // the same on io_uring, which falls back to epoll where it's missing
+  start_server(TEST_PORT + 3, 0,
+               ", \"fft_window\": 65536, \"max_messages_per_turn\": 1, "
+               "\"latency_budget_ms\": 2, \"io_backend\": \"io_uring\"");
+  run_pipeline(TEST_PORT, "inline");
+  run_pipeline(TEST_PORT + 1, "worker pool");
+  run_shedding(TEST_PORT + 2, "shedding");
+  run_shedding(TEST_PORT + 3, "io_uring shedding");
+
+  std::cout << (failures ? "pipeline_test failed" : "pipeline_test passed")
+            << std::endl;
+  // the server threads never return, skip their destructors
+  _exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,137 @@
+#include "protocol.hpp"
+#include "read_json.hpp"
+#include <cctype>
+
+wire_format parse_wire_format(const std::string &name) {
+  if (name == "binary")
+    return wire_format::binary;
+  return wire_format::json;
+}
+
+wire_format detect_wire_format(const char *data, size_t size) {
+  uint32_t magic;
+  if (size < sizeof(magic))
+    return wire_format::json;
+  memcpy(&magic, data, sizeof(magic));
+  return magic == BINARY_MAGIC ? wire_format::binary : wire_format::json;
+}
+
+json::value score_to_json(const metric_score &score) {
+  json::object new_obj;
+  new_obj["_id"] = score.idm;
+
+  json::object r;
+  r["average"].emplace_double() = score.average;
+  r["sq_standard_deviation"].emplace_double() = score.sq_standard_deviation;
+  r["standard_deviation"].emplace_double() = score.standard_deviation;
+  r["dispersion"].emplace_double() = score.dispersion;
+  new_obj["result"] = r;
+  return new_obj;
+}
+
+static void append_header(std::string &out, uint16_t type, uint32_t count) {
+  binary_header header = {BINARY_MAGIC, BINARY_VERSION, type, count};
+  out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+template <class T> static void append_pod(std::string &out, const T &val) {
+  out.append(reinterpret_cast<const char *>(&val), sizeof(val));
+}
+
+void encode_metrics(std::string &out, const json::value &metrics) {
+  const auto &arr = metrics.get_array();
+  append_header(out, BINARY_TYPE_METRICS, arr.size());
+  for (const auto &elem : arr) {
+    const auto &obj = elem.get_object();
+    const auto &data = obj.at("data").get_array();
+    append_pod(out, int32_t(obj.at("_id").get_int64()));
+    append_pod(out, uint32_t(data.size()));
+    for (const auto &e : data)
+      append_pod(out, int32_t(e.get_int64()));
+  }
+}
+
+void encode_scores(std::string &out, const std::vector<metric_score> &scores) {
+  append_header(out, BINARY_TYPE_SCORES, scores.size());
+  for (const auto &score : scores) {
+    append_pod(out, int32_t(score.idm));
+    append_pod(out, uint32_t(0));
+    append_pod(out, score.average);
+    append_pod(out, score.sq_standard_deviation);
+    append_pod(out, score.standard_deviation);
+    append_pod(out, score.dispersion);
+  }
+}
+
+void encode_scores_json(std::string &out,
+                        const std::vector<metric_score> &scores) {
+  // same document as score_to_json() + serialize, without building a DOM
+  out += '[';
+  for (size_t i = 0; i < scores.size(); ++i) {
+    const auto &score = scores[i];
+    if (i)
+      out += ',';
+    out += "{\"_id\":";
+    out += std::to_string(score.idm);
+    out += ",\"result\":{\"average\":";
+    serialize_double(out, score.average);
+    out += ",\"sq_standard_deviation\":";
+    serialize_double(out, score.sq_standard_deviation);
+    out += ",\"standard_deviation\":";
+    serialize_double(out, score.standard_deviation);
+    out += ",\"dispersion\":";
+    serialize_double(out, score.dispersion);
+    out += "}}";
+  }
+  out += ']';
+}
+
+void encode_error(std::string &out, wire_format format) {
+  if (format == wire_format::binary)
+    append_header(out, BINARY_TYPE_ERROR, 0);
+  else
+    out += "{\"error\":\"malformed request\"}";
+}
+
+bool is_error_response(const char *data, size_t size) {
+  binary_header header;
+  if (detect_wire_format(data, size) == wire_format::binary)
+    return read_binary_header(data, size, BINARY_TYPE_ERROR, header);
+  // scores are an array, an error an object
+  const char *end = data + size;
+  while (data != end && isspace(static_cast<unsigned char>(*data)))
+    ++data;
+  return data != end && *data == '{';
+}
+
+bool read_binary_header(const char *data, size_t size, uint16_t type,
+                        binary_header &header) {
+  if (size < sizeof(header))
+    return false;
+  memcpy(&header, data, sizeof(header));
+  return header.magic == BINARY_MAGIC && header.version == BINARY_VERSION &&
+         header.type == type;
+}
+
+bool decode_scores(const char *data, size_t size,
+                   std::vector<metric_score> &scores) {
+  const size_t record_size = 2 * sizeof(int32_t) + 4 * sizeof(double);
+  binary_header header;
+  if (!read_binary_header(data, size, BINARY_TYPE_SCORES, header) ||
+      (size - sizeof(header)) != header.count * record_size)
+    return false;
+
+  const char *p = data + sizeof(header);
+  for (uint32_t i = 0; i < header.count; ++i, p += record_size) {
+    int32_t idm;
+    metric_score score;
+    memcpy(&idm, p, sizeof(idm));
+    score.idm = idm;
+    memcpy(&score.average, p + 8, sizeof(double));
+    memcpy(&score.sq_standard_deviation, p + 16, sizeof(double));
+    memcpy(&score.standard_deviation, p + 24, sizeof(double));
+    memcpy(&score.dispersion, p + 32, sizeof(double));
+    scores.push_back(score);
+  }
+  return true;
+}
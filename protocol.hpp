@@ -0,0 +1,119 @@
+#ifndef __PROTOCOL_HPP__
+#define __PROTOCOL_HPP__
+
+#include <boost/json.hpp>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace json = boost::json;
+
+// A frame payload is either a JSON document or a binary message. Binary
+// messages start with a fixed header whose magic can never begin a JSON text,
+// so the server answers every request in the encoding it was sent in.
+//
+// Binary layout, host byte order (little-endian on every supported target):
+//   header:  uint32 magic, uint16 version, uint16 type, uint32 record count
+//   metrics: per record int32 _id, uint32 sample count, int32 samples[count]
+//   scores:  per record int32 _id, uint32 zero, double average,
+//            sq_standard_deviation, standard_deviation, dispersion
+//   error:   the header alone, record count 0
+//
+// A request the server can't parse is answered with an error, in JSON
+// {"error": "malformed request"}, so every request gets exactly one
+// response and clients match them up in order.
+enum class wire_format { json, binary };
+
+const uint32_t BINARY_MAGIC = 0x42535045; // "EPSB"
+const uint16_t BINARY_VERSION = 1;
+const uint16_t BINARY_TYPE_METRICS = 1;
+const uint16_t BINARY_TYPE_SCORES = 2;
+const uint16_t BINARY_TYPE_ERROR = 3;
+
+struct binary_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t type;
+  uint32_t count;
+};
+
+struct metric_score {
+  int idm;
+  double average;
+  double sq_standard_deviation;
+  double standard_deviation;
+  double dispersion;
+};
+
+wire_format parse_wire_format(const std::string &name);
+
+wire_format detect_wire_format(const char *data, size_t size);
+
+json::value score_to_json(const metric_score &score);
+
+void encode_metrics(std::string &out, const json::value &metrics);
+
+void encode_scores(std::string &out, const std::vector<metric_score> &scores);
+
+void encode_scores_json(std::string &out,
+                        const std::vector<metric_score> &scores);
+
+void encode_error(std::string &out, wire_format format);
+
+bool decode_scores(const char *data, size_t size,
+                   std::vector<metric_score> &scores);
+
+// The response is an error instead of scores, in either encoding
+bool is_error_response(const char *data, size_t size);
+
+bool read_binary_header(const char *data, size_t size, uint16_t type,
+                        binary_header &header);
+
+// Validates a binary metrics message and then calls
+// fn(int idm, const int *samples, size_t count) for every record. Samples are
+// passed in place when the payload happens to be aligned, otherwise through
+// the caller's scratch vector.
+template <class Fn>
+bool decode_metrics(const char *data, size_t size, std::vector<int> &scratch,
+                    Fn &&fn) {
+  binary_header header;
+  if (!read_binary_header(data, size, BINARY_TYPE_METRICS, header))
+    return false;
+
+  const size_t record_header = 2 * sizeof(int32_t);
+  const char *end = data + size;
+  const char *p = data + sizeof(binary_header);
+  for (uint32_t i = 0; i < header.count; ++i) {
+    uint32_t count;
+    if (size_t(end - p) < record_header)
+      return false;
+    memcpy(&count, p + sizeof(int32_t), sizeof(count));
+    p += record_header;
+    if (size_t(end - p) / sizeof(int32_t) < count)
+      return false;
+    p += count * sizeof(int32_t);
+  }
+  if (p != end)
+    return false;
+
+  p = data + sizeof(binary_header);
+  for (uint32_t i = 0; i < header.count; ++i) {
+    int32_t idm;
+    uint32_t count;
+    memcpy(&idm, p, sizeof(idm));
+    memcpy(&count, p + sizeof(int32_t), sizeof(count));
+    p += record_header;
+    const int *samples = reinterpret_cast<const int *>(p);
+    if (reinterpret_cast<uintptr_t>(p) % alignof(int) != 0) {
+      scratch.resize(count);
+      memcpy(scratch.data(), p, count * sizeof(int32_t));
+      samples = scratch.data();
+    }
+    fn(idm, samples, size_t(count));
+    p += count * sizeof(int32_t);
+  }
+  return true;
+}
+
+#endif /* __PROTOCOL_HPP__ */
@@ -1,5 +1,7 @@
 #include "read_json.hpp"
 #include <boost/json.hpp>
+#include <charconv>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -7,10 +9,14 @@
 namespace json = boost::json;
 
 json::value parse_string(const std::string &str) {
+  return parse_string(str.c_str(), str.size());
+}
+
+json::value parse_string(const char *data, size_t size) {
   json::stream_parser p;
   json::error_code ec;
 
-  p.write(str.c_str(), str.size(), ec);
+  p.write(data, size, ec);
 
   if (ec)
     return nullptr;
@@ -119,3 +125,123 @@ void pretty_print(std::stringstream &os, json::value const &jv,
   if (indent->empty())
     os << "\n";
 }
+
+template <class T> static void serialize_number(std::string &out, T val) {
+  char buf[32];
+  auto res = std::to_chars(buf, buf + sizeof(buf), val);
+  out.append(buf, res.ptr);
+}
+
+void serialize_double(std::string &out, double val) {
+  // JSON has no representation for inf and nan
+  if (!std::isfinite(val)) {
+    out += "null";
+    return;
+  }
+  serialize_number(out, val);
+}
+
+void serialize_string(std::string &out, json::string_view str) {
+  static const char *hex = "0123456789abcdef";
+  out += '"';
+  for (char c : str) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        out += "\\u00";
+        out += hex[(c >> 4) & 0xf];
+        out += hex[c & 0xf];
+      } else {
+        out += c;
+      }
+    }
+  }
+  out += '"';
+}
+
+void serialize_int_array(std::string &out, const int *data, size_t size) {
+  // "-2147483648," is the longest element, format in place and trim after
+  const size_t max_elem_size = 12;
+  size_t pos = out.size();
+  out.resize(pos + 2 + size * max_elem_size);
+  char *p = &out[pos];
+  *p++ = '[';
+  for (size_t i = 0; i < size; ++i) {
+    if (i)
+      *p++ = ',';
+    p = std::to_chars(p, p + max_elem_size, data[i]).ptr;
+  }
+  *p++ = ']';
+  out.resize(p - out.data());
+}
+
+void serialize_compact(std::string &out, json::value const &jv) {
+  switch (jv.kind()) {
+  case json::kind::object: {
+    out += '{';
+    bool first = true;
+    for (auto const &elem : jv.get_object()) {
+      if (!first)
+        out += ',';
+      first = false;
+      serialize_string(out, elem.key());
+      out += ':';
+      serialize_compact(out, elem.value());
+    }
+    out += '}';
+    break;
+  }
+
+  case json::kind::array: {
+    out += '[';
+    bool first = true;
+    for (auto const &elem : jv.get_array()) {
+      if (!first)
+        out += ',';
+      first = false;
+      serialize_compact(out, elem);
+    }
+    out += ']';
+    break;
+  }
+
+  case json::kind::string:
+    serialize_string(out, jv.get_string());
+    break;
+
+  case json::kind::uint64:
+    serialize_number(out, jv.get_uint64());
+    break;
+
+  case json::kind::int64:
+    serialize_number(out, jv.get_int64());
+    break;
+
+  case json::kind::double_:
+    serialize_double(out, jv.get_double());
+    break;
+
+  case json::kind::bool_:
+    out += jv.get_bool() ? "true" : "false";
+    break;
+
+  case json::kind::null:
+    out += "null";
+    break;
+  }
+}
@@ -8,9 +8,21 @@ namespace json = boost::json;
 
 json::value parse_string(const std::string &str);
 
+json::value parse_string(const char *data, size_t size);
+
 json::value parse_file(char const *filename);
 
 void pretty_print(std::stringstream &os, json::value const &jv,
                   std::string *indent = nullptr);
 
+// Compact serializers, they append to a caller-owned buffer that can be
+// reused between calls. Numbers are formatted with std::to_chars.
+void serialize_compact(std::string &out, json::value const &jv);
+
+void serialize_string(std::string &out, json::string_view str);
+
+void serialize_double(std::string &out, double val);
+
+void serialize_int_array(std::string &out, const int *data, size_t size);
+
 #endif /* __READ_JSON_HPP__ */
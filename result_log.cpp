@@ -0,0 +1,135 @@
+#include "result_log.hpp"
+#include <charconv>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+const auto RESULT_LOG_DRAIN_INTERVAL = std::chrono::milliseconds(10);
+const size_t RESULT_LOG_BATCH_BYTES = 64 * 1024;
+
+result_sink parse_result_sink(const std::string &name) {
+  if (name == "binary")
+    return result_sink::binary;
+  return result_sink::text;
+}
+
+result_log::result_log(int fd, result_sink sink, size_t capacity)
+    : MFd(fd), MSink(sink) {
+  size_t size = 2;
+  while (size < capacity)
+    size <<= 1;
+  MMask = size - 1;
+  MCells.reset(new cell[size]);
+  for (size_t i = 0; i < size; ++i)
+    MCells[i].sequence.store(i, std::memory_order_relaxed);
+  MThread = std::thread(&result_log::drain_loop, this);
+}
+
+result_log::~result_log() {
+  MStop.store(true, std::memory_order_release);
+  MThread.join();
+}
+
+// Bounded MPSC queue: a cell is free for position pos when its sequence is
+// pos, and holds the record of pos when its sequence is pos + 1
+void result_log::append(const result_record &record) {
+  size_t pos = MTail.load(std::memory_order_relaxed);
+  cell *target;
+  while (true) {
+    target = &MCells[pos & MMask];
+    size_t seq = target->sequence.load(std::memory_order_acquire);
+    auto diff = static_cast<ptrdiff_t>(seq - pos);
+    if (diff == 0) {
+      if (MTail.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      MDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = MTail.load(std::memory_order_relaxed);
+    }
+  }
+  target->record = record;
+  target->sequence.store(pos + 1, std::memory_order_release);
+}
+
+bool result_log::try_pop(result_record &record) {
+  cell &source = MCells[MHead & MMask];
+  if (source.sequence.load(std::memory_order_acquire) != MHead + 1)
+    return false;
+  record = source.record;
+  source.sequence.store(MHead + MMask + 1, std::memory_order_release);
+  ++MHead;
+  return true;
+}
+
+void result_log::drain_loop() {
+  result_record record;
+  while (true) {
+    bool stop = MStop.load(std::memory_order_acquire);
+    while (try_pop(record)) {
+      format(record);
+      if (MBuffer.size() >= RESULT_LOG_BATCH_BYTES)
+        flush();
+    }
+    flush();
+
+    uint64_t dropped = MDropped.load(std::memory_order_relaxed);
+    if (dropped != MReportedDrops) {
+      fprintf(stderr, "result log dropped %llu records\n",
+              (unsigned long long)(dropped - MReportedDrops));
+      MReportedDrops = dropped;
+    }
+
+    if (stop)
+      return;
+    std::this_thread::sleep_for(RESULT_LOG_DRAIN_INTERVAL);
+  }
+}
+
+void result_log::format(const result_record &record) {
+  if (MSink == result_sink::binary) {
+    MBuffer.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    return;
+  }
+
+  // the same output as the std::ostream defaults the log was written with
+  char buf[32];
+  auto append_int = [&](uint64_t val) {
+    MBuffer.append(buf, std::to_chars(buf, buf + sizeof(buf), val).ptr);
+    MBuffer += "; ";
+  };
+  auto append_double = [&](double val) {
+    MBuffer.append(buf, std::to_chars(buf, buf + sizeof(buf), val,
+                                      std::chars_format::general, 6)
+                            .ptr);
+    MBuffer += "; ";
+  };
+  MBuffer.append(buf, std::to_chars(buf, buf + sizeof(buf), record.idm).ptr);
+  MBuffer += "; ";
+  append_int(record.count);
+  append_int(record.history_size);
+  append_double(record.average);
+  append_double(record.sq_standard_deviation);
+  append_double(record.standard_deviation);
+  append_double(record.dispersion);
+  MBuffer.append(buf,
+                 std::to_chars(buf, buf + sizeof(buf), record.spent_ms).ptr);
+  MBuffer += '\n';
+}
+
+void result_log::flush() {
+  size_t offset = 0;
+  while (offset < MBuffer.size()) {
+    ssize_t res = write(MFd, MBuffer.data() + offset, MBuffer.size() - offset);
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("writing result log failed");
+      break;
+    }
+    offset += res;
+  }
+  MBuffer.clear();
+}
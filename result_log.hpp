@@ -0,0 +1,78 @@
+#ifndef __RESULT_LOG_HPP__
+#define __RESULT_LOG_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+// One line of the result log. The binary sink writes these records as they
+// are, in host byte order.
+struct result_record {
+  int32_t idm;
+  uint32_t count;
+  uint64_t history_size;
+  double average;
+  double sq_standard_deviation;
+  double standard_deviation;
+  double dispersion;
+  uint64_t spent_ms;
+};
+
+// text writes "idm; count; history_size; average; sq_sd; sd; dispersion;
+// spent_ms" lines, binary writes raw result_record
+enum class result_sink { text, binary };
+
+result_sink parse_result_sink(const std::string &name);
+
+// Result log of the metric handlers. Any thread appends a record to a bounded
+// lock-free MPSC ring, a background thread drains it, formats the records in
+// batches and writes them to the output fd. When the ring is full a record is
+// dropped and counted, the drain thread reports the count to stderr.
+class result_log {
+public:
+  result_log(int fd, result_sink sink, size_t capacity);
+
+  ~result_log();
+
+  void append(const result_record &record);
+
+  inline uint64_t dropped() const {
+    return MDropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct cell {
+    std::atomic<size_t> sequence;
+    result_record record;
+  };
+
+  bool try_pop(result_record &record);
+
+  void drain_loop();
+
+  void format(const result_record &record);
+
+  void flush();
+
+  int MFd;
+  result_sink MSink;
+  size_t MMask;
+  std::unique_ptr<cell[]> MCells;
+
+  alignas(64) std::atomic<size_t> MTail{0};
+  alignas(64) std::atomic<uint64_t> MDropped{0};
+  alignas(64) std::atomic<bool> MStop{false};
+
+  // owned by the drain thread only
+  size_t MHead = 0;
+  uint64_t MReportedDrops = 0;
+  std::string MBuffer;
+
+  std::thread MThread;
+};
+
+#endif /* __RESULT_LOG_HPP__ */
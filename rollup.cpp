@@ -0,0 +1,107 @@
+#include "rollup.hpp"
+#include <algorithm>
+
+void rollup_bucket::merge(const rollup_bucket &other) {
+  if (!other.count)
+    return;
+  if (!count) {
+    min = other.min;
+    max = other.max;
+  } else {
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+  }
+  sum += other.sum;
+  count += other.count;
+}
+
+size_t rollup_memory_bytes(const std::vector<rollup_tier_config> &tiers) {
+  size_t bytes = 0;
+  for (const auto &config : tiers)
+    bytes += std::max<size_t>(1, config.buckets) * sizeof(rollup_bucket);
+  return bytes;
+}
+
+rollup_tier::rollup_tier(const rollup_tier_config &config)
+    : MBucket(std::max(config.bucket, std::chrono::milliseconds(1))),
+      MCapacity(std::max<size_t>(1, config.buckets)) {}
+
+int64_t rollup_tier::index_of(rollup_clock::time_point time) const {
+  return time.time_since_epoch() / MBucket;
+}
+
+void rollup_tier::add(rollup_clock::time_point now,
+                      const rollup_bucket &batch) {
+  if (MBuckets.empty())
+    MBuckets.resize(MCapacity);
+  int64_t index = index_of(now);
+  rollup_bucket &bucket = MBuckets[index % MCapacity];
+  if (bucket.index != index) {
+    bucket = rollup_bucket();
+    bucket.index = index;
+  }
+  bucket.merge(batch);
+}
+
+rollup_bucket rollup_tier::summary(rollup_clock::time_point now,
+                                   rollup_clock::duration horizon) const {
+  rollup_bucket result;
+  if (MBuckets.empty())
+    return result;
+  int64_t last = index_of(now);
+  int64_t covered = std::min<int64_t>(
+      MCapacity, std::max<int64_t>(1, (horizon + MBucket -
+                                       rollup_clock::duration(1)) /
+                                          MBucket));
+  // a slot still holding an older round of the ring doesn't count
+  for (int64_t index = last - covered + 1; index <= last; ++index) {
+    const rollup_bucket &bucket = MBuckets[index % MCapacity];
+    if (bucket.index == index)
+      result.merge(bucket);
+  }
+  return result;
+}
+
+metric_rollups::metric_rollups(const std::vector<rollup_tier_config> &tiers) {
+  MTiers.reserve(tiers.size());
+  for (const auto &config : tiers)
+    MTiers.emplace_back(config);
+  // summary() looks for the finest tier first
+  std::sort(MTiers.begin(), MTiers.end(),
+            [](const rollup_tier &a, const rollup_tier &b) {
+              return a.span() < b.span();
+            });
+}
+
+void metric_rollups::add(rollup_clock::time_point now, const int *samples,
+                         size_t count) {
+  if (MTiers.empty() || !count)
+    return;
+  rollup_bucket batch;
+  batch.min = batch.max = samples[0];
+  for (size_t i = 0; i < count; ++i) {
+    batch.min = std::min(batch.min, samples[i]);
+    batch.max = std::max(batch.max, samples[i]);
+    batch.sum += samples[i];
+  }
+  batch.count = count;
+  for (auto &tier : MTiers)
+    tier.add(now, batch);
+}
+
+rollup_bucket metric_rollups::summary(rollup_clock::time_point now,
+                                      rollup_clock::duration horizon) const {
+  if (MTiers.empty())
+    return rollup_bucket();
+  for (const auto &tier : MTiers)
+    if (tier.span() >= horizon)
+      return tier.summary(now, horizon);
+  return MTiers.back().summary(now, horizon);
+}
+
+size_t metric_rollups::memory_bytes() const {
+  size_t bytes = 0;
+  for (const auto &tier : MTiers)
+    bytes += tier.memory_bytes();
+  return bytes;
+}
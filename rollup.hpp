@@ -0,0 +1,88 @@
+#ifndef __ROLLUP_HPP__
+#define __ROLLUP_HPP__
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+typedef std::chrono::steady_clock rollup_clock;
+
+// min/max/mean/count of the samples that arrived within one bucket of time
+struct rollup_bucket {
+  // bucket number since the clock's epoch, -1 while empty
+  int64_t index = -1;
+  int min = 0;
+  int max = 0;
+  int64_t sum = 0;
+  uint64_t count = 0;
+
+  inline double mean() const { return count ? double(sum) / count : 0.0; }
+
+  void merge(const rollup_bucket &other);
+};
+
+struct rollup_tier_config {
+  std::chrono::milliseconds bucket;
+  size_t buckets;
+};
+
+// what metric_rollups::memory_bytes() comes to once a metric has samples
+size_t rollup_memory_bytes(const std::vector<rollup_tier_config> &tiers);
+
+// The last `buckets` buckets of one resolution in a ring, a bucket is reset
+// when time comes around to its slot again. Storage is allocated on the
+// first sample.
+class rollup_tier {
+public:
+  explicit rollup_tier(const rollup_tier_config &config);
+
+  void add(rollup_clock::time_point now, const rollup_bucket &batch);
+
+  // everything within the last horizon, O(buckets covered)
+  rollup_bucket summary(rollup_clock::time_point now,
+                        rollup_clock::duration horizon) const;
+
+  inline std::chrono::milliseconds bucket() const { return MBucket; }
+
+  // how far back the tier reaches
+  inline rollup_clock::duration span() const {
+    return MBucket * int64_t(MCapacity);
+  }
+
+  inline size_t memory_bytes() const {
+    return MBuckets.capacity() * sizeof(rollup_bucket);
+  }
+
+private:
+  int64_t index_of(rollup_clock::time_point time) const;
+
+  std::chrono::milliseconds MBucket;
+  size_t MCapacity;
+  std::vector<rollup_bucket> MBuckets;
+};
+
+// Downsampled history of one metric in tiers of increasing bucket size.
+// Every batch updates the current bucket of each tier, so the rollups cost
+// one pass over the samples on ingest, and stats over hours or days are
+// read from a few thousand buckets instead of raw samples.
+class metric_rollups {
+public:
+  explicit metric_rollups(const std::vector<rollup_tier_config> &tiers);
+
+  void add(rollup_clock::time_point now, const int *samples, size_t count);
+
+  // Summary of the last horizon from the finest tier that reaches back that
+  // far, or the coarsest one
+  rollup_bucket summary(rollup_clock::time_point now,
+                        rollup_clock::duration horizon) const;
+
+  inline const std::vector<rollup_tier> &tiers() const { return MTiers; }
+
+  size_t memory_bytes() const;
+
+private:
+  std::vector<rollup_tier> MTiers;
+};
+
+#endif /* __ROLLUP_HPP__ */
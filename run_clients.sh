@@ -8,11 +8,8 @@ if [[ "$@" > 1 ]]; then
 fi
 echo "run $NUM_CLIENTS number of clients"
 
-for ((n=0;n<$NUM_CLIENTS;n++))
-do
-    echo "run clint# $n"
-    ./client -c $SCRIPT_DIR/configs/client.cfg -l
-done
+# One process simulates all clients, each with its own connection, and
+# prints throughput and latency percentiles when it's done
+./client -c $SCRIPT_DIR/configs/client.cfg -g $NUM_CLIENTS
 
 echo "done!"
-
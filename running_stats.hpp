@@ -0,0 +1,44 @@
+#ifndef __RUNNING_STATS_HPP__
+#define __RUNNING_STATS_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Running sums over the samples currently in a metric's window. Samples are
+// integers, so the sums are kept exactly (the sum of squares in 128 bits) and
+// never drift, however many samples enter and leave the window.
+class running_stats {
+public:
+  inline void add(int val) {
+    ++MCount;
+    MSum += val;
+    MSumSq += int64_t(val) * val;
+  }
+
+  inline void remove(int val) {
+    --MCount;
+    MSum -= val;
+    MSumSq -= int64_t(val) * val;
+  }
+
+  inline size_t count() const { return MCount; }
+
+  inline double average() const {
+    return MCount ? double(MSum) / MCount : 0.0;
+  }
+
+  // population variance: (n * sum(x^2) - sum(x)^2) / n^2
+  inline double dispersion() const {
+    if (!MCount)
+      return 0.0;
+    __int128 num = __int128(MCount) * MSumSq - __int128(MSum) * MSum;
+    return double(num) / (double(MCount) * MCount);
+  }
+
+private:
+  size_t MCount = 0;
+  int64_t MSum = 0;
+  __int128 MSumSq = 0;
+};
+
+#endif /* __RUNNING_STATS_HPP__ */
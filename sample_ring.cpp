@@ -0,0 +1,73 @@
+#include "sample_ring.hpp"
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+
+const size_t MIN_RING_CAPACITY = 1024;
+
+static size_t round_up_to_power_of_2(size_t x) {
+  size_t p = 1;
+  while (p < x)
+    p <<= 1;
+  return p;
+}
+
+sample_ring::sample_ring(size_t window) : MWindow(window) {}
+
+void sample_ring::reserve(size_t count) {
+  if (count <= MData.size())
+    return;
+
+  size_t capacity = round_up_to_power_of_2(
+      std::max({count, MIN_RING_CAPACITY, MData.size() * 2}));
+  capacity = std::min(capacity, round_up_to_power_of_2(MWindow));
+
+  // linearize the current content into the new storage
+  std::vector<int> data(capacity);
+  sample_span first, second;
+  spans(MBegin, size(), first, second);
+  memcpy(data.data(), first.data, first.size * sizeof(int));
+  memcpy(data.data() + first.size, second.data, second.size * sizeof(int));
+
+  MEnd = size();
+  MBegin = 0;
+  MData.swap(data);
+  MMask = capacity - 1;
+}
+
+void sample_ring::append(const int *samples, size_t count) {
+  assert(size() + count <= MWindow);
+  reserve(size() + count);
+
+  size_t pos = MEnd & MMask;
+  size_t head = std::min(count, MData.size() - pos);
+  memcpy(MData.data() + pos, samples, head * sizeof(int));
+  memcpy(MData.data(), samples + head, (count - head) * sizeof(int));
+  MEnd += count;
+}
+
+void sample_ring::drop_front(size_t count) {
+  MBegin += std::min(count, size());
+}
+
+void sample_ring::spans(uint64_t from, size_t n, sample_span &first,
+                        sample_span &second) const {
+  first = second = {MData.data(), 0};
+  if (n == 0)
+    return;
+  size_t pos = from & MMask;
+  size_t head = std::min(n, MData.size() - pos);
+  first = {MData.data() + pos, head};
+  second = {MData.data(), n - head};
+}
+
+void sample_ring::oldest(size_t n, sample_span &first,
+                         sample_span &second) const {
+  spans(MBegin, std::min(n, size()), first, second);
+}
+
+void sample_ring::latest(size_t n, sample_span &first,
+                         sample_span &second) const {
+  n = std::min(n, size());
+  spans(MEnd - n, n, first, second);
+}
@@ -0,0 +1,53 @@
+#ifndef __SAMPLE_RING_HPP__
+#define __SAMPLE_RING_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct sample_span {
+  const int *data;
+  size_t size;
+};
+
+// Contiguous ring of the latest samples of one metric. The storage is a power
+// of two, so positions wrap with a mask. It grows by doubling until it can
+// hold the whole window and is never reallocated after that.
+class sample_ring {
+public:
+  explicit sample_ring(size_t window);
+
+  inline size_t size() const { return MEnd - MBegin; }
+
+  inline size_t window() const { return MWindow; }
+
+  // allocated samples
+  inline size_t capacity() const { return MData.size(); }
+
+  inline int at(size_t i) const { return MData[(MBegin + i) & MMask]; }
+
+  // Appends samples with at most two memcpy calls. The caller trims first,
+  // size() + count must not exceed window().
+  void append(const int *samples, size_t count);
+
+  // Drops the oldest count samples in O(1)
+  void drop_front(size_t count);
+
+  // The oldest/latest n samples as at most two contiguous spans, in order
+  void oldest(size_t n, sample_span &first, sample_span &second) const;
+  void latest(size_t n, sample_span &first, sample_span &second) const;
+
+private:
+  void reserve(size_t count);
+
+  void spans(uint64_t from, size_t n, sample_span &first,
+             sample_span &second) const;
+
+  std::vector<int> MData;
+  size_t MWindow;
+  size_t MMask = 0;
+  uint64_t MBegin = 0;
+  uint64_t MEnd = 0;
+};
+
+#endif /* __SAMPLE_RING_HPP__ */
@@ -1,24 +1,41 @@
 #include "server.hpp"
 #include "connection.hpp"
+#include "fft.hpp"
+#include "frame.hpp"
+#include "metric_scanner.hpp"
+#include "protocol.hpp"
 #include "read_json.hpp"
+#include "spectrum_writer.hpp"
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cassert>
 #include <chrono>
 #include <fcntl.h>
-#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <thread>
 
 const int MAX_EVENTS = 64;
 const int MAX_NUM_CLIENTS = 10'000;
-const int MAX_NUM_METRICS = 1'000'000;
+const size_t MAX_PENDING_OUTPUT = 16 * 1024 * 1024;
+const size_t MAX_PENDING_REQUESTS = 64;
+// the admin snapshot summarizes each shown metric over these spans
+const std::chrono::seconds ADMIN_ROLLUP_HORIZONS[] = {
+    std::chrono::minutes(1), std::chrono::hours(1), std::chrono::hours(24)};
+
+// epoll_event.data.ptr of the reactor's own descriptors, anything else
+// points at a client_connection
+static char LISTEN_TAG, ADMIN_TAG, MAILBOX_TAG;
 
 server::~server() {
-  close(MListenSock);
-  for (auto &fd : MFilename2FdMap) {
-    close(fd.second);
+  for (auto sock : MListenSocks) {
+    close(sock);
   }
+  if (MAdminSock != -1)
+    close(MAdminSock);
 }
 
 bool server::read_config(const std::string &str) {
@@ -27,374 +44,927 @@ bool server::read_config(const std::string &str) {
   // std::stringstream ss;
   // pretty_print(ss, MConfig);
   // std::cout << ss.str()  << std::endl;
+
+  auto cfg = MConfig.get_object();
+  if (auto *val = cfg.if_contains("fft_window")) {
+    // the transform size must be a power of two, round down
+    size_t window = val->as_int64();
+    MFftWindow = 0;
+    while (window >>= 1)
+      MFftWindow = MFftWindow ? MFftWindow << 1 : 2;
+  }
+  if (auto *val = cfg.if_contains("fft_hop"))
+    MFftHop = std::max<int64_t>(1, val->as_int64());
+  // the legacy FFT window spans the whole history, it can't be compressed
+  if (auto *val = cfg.if_contains("history_compression"))
+    if (val->as_bool() && MFftWindow)
+      MHotWindow = MFftWindow;
+  if (auto *val = cfg.if_contains("history_memory_mb"))
+    MHistoryBudget = std::max<int64_t>(0, val->as_int64()) * 1024 * 1024;
+  // an empty list turns the rollups off
+  if (auto *val = cfg.if_contains("rollup_tiers")) {
+    MRollupTiers.clear();
+    for (const auto &elem : val->as_array()) {
+      const auto &tier = elem.as_object();
+      MRollupTiers.push_back(
+          {std::chrono::seconds(tier.at("bucket_s").as_int64()),
+           size_t(tier.at("buckets").as_int64())});
+    }
+  }
+  if (auto *val = cfg.if_contains("admin_rollup_metrics"))
+    MAdminRollupMetrics = std::max<int64_t>(0, val->as_int64());
+  if (auto *val = cfg.if_contains("pretty_print"))
+    MPrettyPrint = val->as_bool();
+  if (auto *val = cfg.if_contains("max_read_per_turn"))
+    MMaxReadPerTurn = std::max<int64_t>(1, val->as_int64());
+  if (auto *val = cfg.if_contains("max_messages_per_turn"))
+    MMaxMessagesPerTurn = std::max<int64_t>(1, val->as_int64());
+  if (auto *val = cfg.if_contains("latency_budget_ms"))
+    MLatencyBudget = std::chrono::milliseconds(val->as_int64());
+  if (auto *val = cfg.if_contains("idle_timeout_ms"))
+    MIdleTimeout = std::chrono::milliseconds(val->as_int64());
+  if (auto *val = cfg.if_contains("stats_interval_ms"))
+    MStatsInterval = std::chrono::milliseconds(val->as_int64());
   return true;
 }
 
 bool server::run() {
+  auto cfg = MConfig.get_object();
+  int num_of_threads = 1;
+  if (auto *val = cfg.if_contains("number_of_threads"))
+    num_of_threads = val->as_int64();
+  if (num_of_threads <= 0)
+    num_of_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  if (auto *val = cfg.if_contains("io_backend")) {
+    std::string name = val->as_string().c_str();
+    if (name == "io_uring")
+      MIoBackend = io_backend::io_uring;
+    else if (name != "epoll")
+      std::cerr << "unknown io_backend " << name << ", using epoll"
+                << std::endl;
+  }
 
-  start_listening();
+  // Every reactor gets its own SO_REUSEPORT listen socket, so the kernel
+  // spreads incoming connections between them
+  uint64_t listen_port = cfg["listen_port"].get_int64();
+  for (int i = 0; i < num_of_threads; ++i)
+    MListenSocks.push_back(start_listening(listen_port));
+
+  // the first reactor answers every connection to the admin port with a
+  // JSON stats snapshot
+  if (auto *val = cfg.if_contains("admin_port"))
+    MAdminSock = start_listening(val->as_int64());
+
+  // FFT and persistence run on the pool, so reactors never wait for them
+  int num_of_workers = 0;
+  if (auto *val = cfg.if_contains("number_of_workers"))
+    num_of_workers = val->as_int64();
+  if (num_of_workers > 0)
+    MWorkers.reset(new thread_pool(num_of_workers));
+
+  if (MNeedSaveData) {
+    std::string log_dir = cfg["path_to_folder_of_log"].as_string().c_str();
+    spectrum_format format = spectrum_format::json;
+    if (auto *val = cfg.if_contains("spectrum_store"))
+      format = parse_spectrum_format(val->as_string().c_str());
+    int64_t flush_interval_ms = 100;
+    if (auto *val = cfg.if_contains("persist_interval_ms"))
+      flush_interval_ms = val->as_int64();
+    MSpectrumWriter.reset(
+        new spectrum_writer(log_dir, format, MPrettyPrint,
+                            std::chrono::milliseconds(flush_interval_ms),
+                            MIoBackend == io_backend::io_uring));
+  }
 
-  set_nonblocking(STDOUT_FILENO);
+  // Results go to stdout unless a file is given, "none" turns the log off
+  std::string result_sink_name = "text";
+  if (auto *val = cfg.if_contains("result_log"))
+    result_sink_name = val->as_string().c_str();
+  if (result_sink_name != "none") {
+    int log_fd = STDOUT_FILENO;
+    if (auto *val = cfg.if_contains("result_log_path")) {
+      log_fd = open(val->as_string().c_str(), O_CREAT | O_WRONLY | O_APPEND,
+                    S_IRUSR | S_IWUSR);
+      if (log_fd == -1) {
+        perror("open() failed");
+        return false;
+      }
+    }
+    size_t capacity = 64 * 1024;
+    if (auto *val = cfg.if_contains("result_log_capacity"))
+      capacity = std::max<int64_t>(1, val->as_int64());
+    MResultLog.reset(
+        new result_log(log_fd, parse_result_sink(result_sink_name), capacity));
+  }
+
+  std::vector<std::thread> reactors;
+  for (int i = 1; i < num_of_threads; ++i)
+    reactors.emplace_back(&server::run_backend, this, MListenSocks[i]);
+
+  run_backend(MListenSocks[0]);
 
+  for (auto &reactor : reactors)
+    reactor.join();
+  return true;
+}
+
+void server::run_backend(int listen_sock) {
+  if (MIoBackend == io_backend::io_uring && run_uring_reactor(listen_sock))
+    return;
+  run_reactor(listen_sock);
+}
+
+void server::run_reactor(int listen_sock) {
   int epollfd = epoll_create1(0);
   if (epollfd == -1) {
     perror("epoll_create1 failed");
     exit(EXIT_FAILURE);
   }
 
-  epoll_ctl_add(epollfd, MListenSock, EPOLLIN);
+  // The listen socket stays level-triggered, so connections left in the
+  // backlog are accepted on the next wakeup
+  epoll_ctl_add(epollfd, listen_sock, EPOLLIN, &LISTEN_TAG);
+  if (MAdminSock != -1 && listen_sock == MListenSocks[0])
+    epoll_ctl_add(epollfd, MAdminSock, EPOLLIN, &ADMIN_TAG);
+
+  // workers hand finished responses back through the mailbox
+  reactor_mailbox mailbox;
+  mailbox.eventfd = eventfd(0, EFD_NONBLOCK);
+  if (mailbox.eventfd == -1) {
+    perror("eventfd() failed");
+    exit(EXIT_FAILURE);
+  }
+  epoll_ctl_add(epollfd, mailbox.eventfd, EPOLLIN, &MAILBOX_TAG);
+
+  // every client connection owned by this reactor, by id
+  std::unordered_map<uint64_t, std::unique_ptr<client_connection>> connections;
+  // Connections closed during the current wakeup. Later events of the same
+  // batch may still point at them, so they are freed after the batch.
+  std::vector<std::unique_ptr<client_connection>> closed;
+  // connections that used up their read budget with input left
+  std::vector<uint64_t> ready;
+  uint64_t next_connection_id = 0;
+
+  // idle timeouts and periodic work, epoll_wait() sleeps until the next one
+  timer_wheel timers(TIMER_TICK);
+  auto now = std::chrono::steady_clock::now();
+
+  auto close_connection = [&](client_connection &conn) {
+    timers.cancel(conn.idle_timer);
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, conn.fd, NULL);
+    close(conn.fd);
+    add_counter(counter::syscalls, 2);
+    conn.fd = -1;
+    auto it = connections.find(conn.id);
+    closed.push_back(std::move(it->second));
+    connections.erase(it);
+    if (!conn.admin)
+      add_counter(counter::connections_closed);
+  };
+
+  auto service = [&](client_connection &conn) {
+    if (!service_connection(conn, mailbox) || is_finished(conn)) {
+      close_connection(conn);
+      return;
+    }
+    // round-robin: a connection with work left goes to the back of the line
+    if ((conn.readable || conn.throttled) && !conn.queued &&
+        !is_backlogged(conn)) {
+      conn.queued = true;
+      ready.push_back(conn.id);
+    }
+  };
+
+  // Out of descriptors the backlog stays readable, and a level-triggered
+  // listen socket would wake the reactor up again at once. It leaves epoll
+  // instead and comes back when the timer fires.
+  timer accept_timer([&]() {
+    epoll_ctl_add(epollfd, listen_sock, EPOLLIN, &LISTEN_TAG);
+    add_counter(counter::syscalls);
+  });
+
+  auto accept_connections = [&]() {
+    // drain the whole accept queue, a reconnect storm takes one wakeup
+    while (true) {
+      int client_fd =
+          accept4(listen_sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      add_counter(counter::syscalls);
+      if (client_fd == -1) {
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          return;
+        int error = errno;
+        perror("accept4() failed");
+        if (is_out_of_descriptors(error)) {
+          epoll_ctl(epollfd, EPOLL_CTL_DEL, listen_sock, NULL);
+          add_counter(counter::syscalls);
+          timers.schedule(accept_timer, now + ACCEPT_BACKOFF);
+        }
+        return;
+      }
+
+      std::unique_ptr<client_connection> conn(new client_connection());
+      conn->fd = client_fd;
+      conn->id = next_connection_id++;
+      conn->connected_at = conn->last_active = now;
+      epoll_ctl_add(epollfd, client_fd,
+                    EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, conn.get());
+      if (MIdleTimeout.count()) {
+        // traffic only moves last_active, the timer catches up when it fires
+        client_connection *ptr = conn.get();
+        conn->idle_timer.set_callback([&, ptr]() {
+          auto deadline = idle_deadline(*ptr, now);
+          if (deadline > now) {
+            timers.schedule(ptr->idle_timer, deadline);
+            return;
+          }
+          add_counter(counter::connections_evicted);
+          close_connection(*ptr);
+        });
+        timers.schedule(conn->idle_timer, now + MIdleTimeout);
+      }
+      connections[conn->id] = std::move(conn);
+      add_counter(counter::connections_accepted);
+    }
+  };
+
+  timer admin_accept_timer([&]() {
+    epoll_ctl_add(epollfd, MAdminSock, EPOLLIN, &ADMIN_TAG);
+    add_counter(counter::syscalls);
+  });
+
+  // An admin client gets the snapshot through its writer and EPOLLOUT like
+  // any response, so a slow reader never blocks the reactor. It's closed
+  // once the snapshot is out, or after ADMIN_SEND_TIMEOUT.
+  auto accept_admins = [&]() {
+    std::string reply;
+    while (true) {
+      int admin_fd =
+          accept4(MAdminSock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      add_counter(counter::syscalls);
+      if (admin_fd == -1) {
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          return;
+        int error = errno;
+        perror("accept4() failed");
+        if (is_out_of_descriptors(error)) {
+          epoll_ctl(epollfd, EPOLL_CTL_DEL, MAdminSock, NULL);
+          add_counter(counter::syscalls);
+          timers.schedule(admin_accept_timer, now + ACCEPT_BACKOFF);
+        }
+        return;
+      }
+
+      // one snapshot for everyone who asked in this wakeup
+      if (reply.empty())
+        reply = admin_reply();
+      std::unique_ptr<client_connection> conn(new client_connection());
+      conn->fd = admin_fd;
+      conn->id = next_connection_id++;
+      conn->admin = true;
+      conn->writer.push_raw(reply);
+      if (!conn->writer.flush(admin_fd) || conn->writer.empty()) {
+        close(admin_fd);
+        continue;
+      }
+      epoll_ctl_add(epollfd, admin_fd, EPOLLOUT | EPOLLET, conn.get());
+      client_connection *ptr = conn.get();
+      conn->idle_timer.set_callback([&, ptr]() { close_connection(*ptr); });
+      timers.schedule(conn->idle_timer, now + ADMIN_SEND_TIMEOUT);
+      connections[conn->id] = std::move(conn);
+    }
+  };
+
+  timer stats_timer([&]() {
+    log_stats();
+    timers.schedule(stats_timer, now + MStatsInterval);
+  });
+  if (MStatsInterval.count() && listen_sock == MListenSocks[0])
+    timers.schedule(stats_timer, now + MStatsInterval);
 
   struct epoll_event events[MAX_EVENTS];
+  std::vector<uint64_t> turn;
   for (;;) {
-    int event_count = epoll_wait(epollfd, events, MAX_EVENTS, -1);
+    turn.swap(ready);
+    int timeout = turn.empty() ? timers.timeout_ms(now) : 0;
+    int event_count = epoll_wait(epollfd, events, MAX_EVENTS, timeout);
+    add_counter(counter::syscalls);
+    now = std::chrono::steady_clock::now();
     if (event_count == -1) {
+      if (errno == EINTR)
+        continue;
       perror("epoll_wait() failed");
       exit(EXIT_FAILURE);
-    } else if (event_count == 0) {
-      // return from epol_wait by timeout
-      continue;
     }
 
     for (int i = 0; i < event_count; ++i) {
-      if (events[i].data.fd == MListenSock) {
-        while (true) {
-          struct sockaddr_in client_addr;
-          socklen_t client_addr_len = sizeof(client_addr);
-          int client_fd = accept(MListenSock, (struct sockaddr *)&client_addr,
-                                 &client_addr_len);
-          if (client_fd == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-              // we processed all of the connections
-              break;
-            } else {
-              perror("accept() failed");
-              exit(EXIT_FAILURE);
-            }
-          } else {
-            set_nonblocking(client_fd);
-            epoll_ctl_add(epollfd, client_fd, EPOLLIN);
-            break;
-          }
+      void *ptr = events[i].data.ptr;
+      if (ptr == &LISTEN_TAG) {
+        accept_connections();
+      } else if (ptr == &ADMIN_TAG) {
+        accept_admins();
+      } else if (ptr == &MAILBOX_TAG) {
+        uint64_t wakeups;
+        read(mailbox.eventfd, &wakeups, sizeof(wakeups));
+        add_counter(counter::syscalls);
+
+        std::vector<completed_request> done;
+        {
+          std::lock_guard<std::mutex> guard(mailbox.lock);
+          done.swap(mailbox.done);
         }
-      } else {
-        if (events[i].events & EPOLLIN) {
-          int client_fd = events[i].data.fd;
-
-          const auto &rdata_str = receive_from_client(client_fd, epollfd);
-          if (rdata_str.empty())
+        for (auto &request : done) {
+          // the connection may be gone by now
+          auto it = connections.find(request.connection_id);
+          if (it == connections.end())
             continue;
-
-          const auto &rdata = parse_string(rdata_str);
-
-          const auto &response_to_send = handle_data(rdata);
-
-          send_to_client(client_fd, response_to_send);
-        } else {
-          std::cerr << "Unexpected case while handling event" << std::endl;
-          exit(EXIT_FAILURE);
+          auto &conn = *it->second;
+          send_to_client(conn, std::move(request.response));
+          conn.busy = false;
+          service(conn);
         }
+      } else {
+        auto &conn = *static_cast<client_connection *>(ptr);
+        if (conn.fd == -1)
+          continue;
+        if (conn.admin) {
+          if ((events[i].events & (EPOLLHUP | EPOLLERR)) ||
+              !conn.writer.flush(conn.fd) || conn.writer.empty())
+            close_connection(conn);
+          continue;
+        }
+        // the connection is broken, whatever was still in flight is dropped
+        if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+          close_connection(conn);
+          continue;
+        }
+        // A half-close comes with the client's last requests, they are read
+        // up to the EOF and answered before the connection closes
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+          conn.readable = true;
+        service(conn);
       }
+    }
 
-      if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-        epoll_ctl(epollfd, EPOLL_CTL_DEL, events[i].data.fd, NULL);
-        close(events[i].data.fd);
+    for (uint64_t id : turn) {
+      auto it = connections.find(id);
+      if (it == connections.end())
         continue;
-      }
+      it->second->queued = false;
+      service(*it->second);
     }
+    turn.clear();
+    timers.advance(now);
+    closed.clear();
   }
 
+  close(mailbox.eventfd);
   if (close(epollfd)) {
     perror("close() epollfd failed");
     exit(EXIT_FAILURE);
   }
 }
 
-void server::start_listening() {
-  auto cfg = MConfig.get_object();
-  std::string listen_ip = json::serialize(cfg["listen_ip"].get_string());
-  uint64_t listen_port = cfg["listen_port"].get_int64();
-
+int server::start_listening(uint64_t listen_port) {
   struct sockaddr_in server_addr = {0};
   set_sockaddr(&server_addr, listen_port);
-  MListenSock = Socket(AF_INET, SOCK_STREAM, 0);
+  int listen_sock = Socket(AF_INET, SOCK_STREAM, 0);
 
   int enable = 1;
-  if (setsockopt(MListenSock, SOL_SOCKET, SO_REUSEADDR, &enable,
+  if (setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &enable,
+                 sizeof(enable)) == -1)
+    perror("setsockopt failed");
+  if (setsockopt(listen_sock, SOL_SOCKET, SO_REUSEPORT, &enable,
                  sizeof(enable)) == -1)
     perror("setsockopt failed");
 
-  Bind(MListenSock, (struct sockaddr *)&server_addr, sizeof(server_addr));
+  Bind(listen_sock, (struct sockaddr *)&server_addr, sizeof(server_addr));
 
-  Listen(MListenSock, MAX_NUM_CLIENTS);
+  Listen(listen_sock, MAX_NUM_CLIENTS);
 
-  set_nonblocking(MListenSock);
+  set_nonblocking(listen_sock);
+  return listen_sock;
 }
 
-std::string server::receive_from_client(int client_fd, int epollfd) {
-  static uint64_t rec_msgs_count = 0;
-  // std::cout << "Try to receive Msg#: " << rec_msgs_count << std::endl;
-  std::stringstream ss;
-  char buf[1024];
-  while (true) {
-    int nbytes = read(client_fd, buf, sizeof(buf));
+bool server::receive_from_client(client_connection &conn) {
+  stage_timer timer(stage::read);
+  size_t budget = MMaxReadPerTurn;
+  while (budget > 0) {
+    ssize_t nbytes = conn.reader.read_some(conn.fd);
+    add_counter(counter::syscalls);
     if (nbytes == -1) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
         // std::cout << "Finished reading data from client" << std::endl;
-        break;
+        conn.readable = false;
+        return true;
       } else {
         perror("read() failed");
-        exit(EXIT_FAILURE);
+        return false;
       }
     } else if (nbytes == 0) {
-      close(client_fd);
-      epoll_ctl(epollfd, EPOLL_CTL_DEL, client_fd, NULL);
-      break;
-    } else {
-      buf[nbytes] = '\0';
-      ss << buf;
+      conn.readable = false;
+      conn.read_closed = true;
+      return true;
     }
+    add_counter(counter::bytes_read, nbytes);
+    conn.bytes_read += nbytes;
+    conn.last_active = std::chrono::steady_clock::now();
+    budget -= std::min<size_t>(budget, nbytes);
   }
-  // std::cout << "Server received: \"" << ss.str() << "\"" << std::endl;
-  // std::cout << "Total received msgs: " << ++rec_msgs_count << std::endl;
-  return ss.str();
+  // the rest waits for the next turn, so one client can't hog the reactor
+  return true;
 }
 
-json::value server::calc_confidence_score(int idm,
-                                          const std::deque<int> &deque) {
-  auto do_average = [](std::deque<int> const &v) -> double {
-    if (v.empty())
-      return 0.0;
-    double partial_sum = 0.0;
-    std::for_each(std::begin(v), std::end(v),
-                  [&](const int d) { partial_sum += d / ((double)v.size()); });
-    return partial_sum;
-  };
+bool server::flush_to_client(client_connection &conn) {
+  if (conn.writer.empty())
+    return true;
+  stage_timer timer(stage::write);
+  size_t pending = conn.writer.pending_bytes();
+  // usually a single sendmsg(), more only for output beyond MAX_WRITE_IOV
+  bool ok = conn.writer.flush(conn.fd);
+  add_counter(counter::syscalls);
+  add_counter(counter::bytes_written, pending - conn.writer.pending_bytes());
+  conn.bytes_written += pending - conn.writer.pending_bytes();
+  return ok;
+}
 
-  auto do_dispersion = [](std::deque<int> const &v, double m) -> double {
-    if (v.empty())
-      return 0.0;
-    double partial_sum = 0.0;
-    std::for_each(std::begin(v), std::end(v), [&](const int d) {
-      partial_sum += (d - m) * (d - m) / ((double)v.size());
-    });
-    return partial_sum;
-  };
+bool server::service_connection(client_connection &conn,
+                                reactor_mailbox &mailbox) {
+  // A backlogged client is not read from until it takes its responses, so
+  // TCP pushes back on it. Frames held back meanwhile are handled here too.
+  if (!flush_to_client(conn))
+    return false;
+  if (conn.readable && !is_backlogged(conn) && !receive_from_client(conn))
+    return false;
+  handle_frames(conn, mailbox);
+  if (conn.reader.is_broken())
+    return false;
+  return flush_to_client(conn);
+}
 
+std::string server::admin_reply() {
+  std::string str = json::serialize(admin_snapshot());
+  str += '\n';
+  return str;
+}
+
+json::object server::admin_snapshot() {
+  auto snapshot = stats_snapshot();
+
+  // No history lock is taken: a metric's lock is held across its FFT, and
+  // the snapshot runs on a reactor
+  size_t num_metrics = 0;
+  // (samples received, _id) of every metric
+  std::vector<std::pair<uint64_t, int>> totals;
+  for (auto &shard : MMetricShards) {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    num_metrics += shard.buffers.size();
+    if (!MAdminRollupMetrics || MRollupTiers.empty())
+      continue;
+    for (auto &elem : shard.buffers)
+      totals.emplace_back(elem.second.received.load(), elem.first);
+  }
+
+  // Rollups of the busiest metrics only, so the snapshot stays small
+  // however many metrics there are. Each horizon is read from the finest
+  // tier that covers it, metrics past the rollup budget have none.
+  size_t shown = std::min(totals.size(), MAdminRollupMetrics);
+  std::partial_sort(totals.begin(), totals.begin() + shown, totals.end(),
+                    std::greater<std::pair<uint64_t, int>>());
+  json::object rollups;
+  auto now = rollup_clock::now();
+  for (size_t i = 0; i < shown; ++i) {
+    int idm = totals[i].second;
+    std::vector<rollup_bucket> summaries;
+    {
+      // entries are never erased, the history outlives the shard lock
+      metric_history *history;
+      {
+        auto &shard = shard_of(idm);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        history = &shard.buffers.find(idm)->second;
+      }
+      std::lock_guard<std::mutex> rollups_guard(history->rollups_lock);
+      if (history->rollups.tiers().empty())
+        continue;
+      for (auto horizon : ADMIN_ROLLUP_HORIZONS)
+        summaries.push_back(history->rollups.summary(now, horizon));
+    }
+
+    json::array entries;
+    for (size_t h = 0; h < summaries.size(); ++h) {
+      const rollup_bucket &summary = summaries[h];
+      json::object entry;
+      entry["horizon_s"] = ADMIN_ROLLUP_HORIZONS[h].count();
+      entry["count"] = summary.count;
+      entry["min"] = summary.min;
+      entry["max"] = summary.max;
+      entry["mean"] = summary.mean();
+      entries.push_back(std::move(entry));
+    }
+    rollups[std::to_string(idm)] = std::move(entries);
+  }
+
+  json::object gauges;
+  gauges["metrics"] = num_metrics;
+  gauges["buffer_bytes"] = MBufferBytes.load(std::memory_order_relaxed);
+  gauges["history_bytes"] = MHistoryBytes.load(std::memory_order_relaxed);
+  gauges["rollup_bytes"] = MRollupBytes.load(std::memory_order_relaxed);
+  gauges["results_dropped"] = MResultLog ? MResultLog->dropped() : 0;
+  snapshot["gauges"] = std::move(gauges);
+  if (MAdminRollupMetrics)
+    snapshot["rollups"] = std::move(rollups);
+  return snapshot;
+}
+
+void server::log_stats() {
+  std::cerr << json::serialize(admin_snapshot()) << std::endl;
+}
+
+std::chrono::steady_clock::time_point
+server::idle_deadline(const client_connection &conn,
+                      std::chrono::steady_clock::time_point now) const {
+  if (conn.busy || !conn.pending.empty() || !conn.writer.empty())
+    return now + MIdleTimeout;
+  return conn.last_active + MIdleTimeout;
+}
+
+bool server::is_backlogged(const client_connection &conn) const {
+  return conn.writer.pending_bytes() >= MAX_PENDING_OUTPUT ||
+         conn.pending.size() >= MAX_PENDING_REQUESTS;
+}
+
+bool server::is_finished(const client_connection &conn) const {
+  return conn.read_closed && !conn.readable && !conn.throttled &&
+         !conn.busy && conn.pending.empty() && conn.writer.empty();
+}
+
+void server::handle_frames(client_connection &conn,
+                           reactor_mailbox &mailbox) {
+  // Dispatch complete frames up to the turn's budget, a partial one waits
+  // for more data. Frames left over wait for the connection's next turn,
+  // their latency budget counts from when they were read all the same.
+  std::chrono::steady_clock::time_point arrived;
+  const char *data;
+  size_t size;
+  size_t budget = MMaxMessagesPerTurn;
+  while (budget > 0 && !is_backlogged(conn) &&
+         conn.reader.next_frame(data, size, arrived)) {
+    ++conn.requests;
+    --budget;
+    if (MWorkers) {
+      conn.pending.push_back({std::string(data, size), arrived});
+      continue;
+    }
+    std::string response;
+    process_request(data, size, arrived, response);
+    send_to_client(conn, std::move(response));
+  }
+  conn.throttled = budget == 0;
+  if (MWorkers)
+    dispatch_pending(conn, mailbox);
+}
+
+void server::dispatch_pending(client_connection &conn,
+                              reactor_mailbox &mailbox) {
+  if (conn.busy || conn.pending.empty())
+    return;
+
+  // one request per connection at a time keeps responses in request order
+  conn.busy = true;
+  pending_request request = std::move(conn.pending.front());
+  conn.pending.pop_front();
+  uint64_t connection_id = conn.id;
+
+  MWorkers->submit([this, &mailbox, connection_id,
+                    request = std::move(request)]() {
+    completed_request done;
+    done.connection_id = connection_id;
+    process_request(request.data.data(), request.data.size(),
+                    request.arrived, done.response);
+    {
+      std::lock_guard<std::mutex> guard(mailbox.lock);
+      mailbox.done.push_back(std::move(done));
+    }
+    uint64_t one = 1;
+    write(mailbox.eventfd, &one, sizeof(one));
+  });
+}
+
+bool server::process_request(const char *data, size_t size,
+                             std::chrono::steady_clock::time_point arrived,
+                             std::string &response) {
+  thread_local std::vector<metric_score> scores;
+  scores.clear();
+  add_counter(counter::messages);
+
+  // Over the latency budget the server degrades instead of falling further
+  // behind: the response carries the stats as usual, the FFT is skipped
+  bool shed = MLatencyBudget.count() &&
+              std::chrono::steady_clock::now() - arrived > MLatencyBudget;
+  if (shed)
+    add_counter(counter::shed_requests);
+
+  // answer in the same encoding the request came in
+  auto format = detect_wire_format(data, size);
+  bool ok = format == wire_format::binary
+                ? handle_binary_data(data, size, scores, shed)
+                : handle_data(data, size, scores, shed);
+  if (!ok) {
+    // still answered, the client matches responses to requests in order
+    add_counter(counter::parse_failures);
+    response.clear();
+    encode_error(response, format);
+    return false;
+  }
+
+  stage_timer timer(stage::serialize);
+  encode_response(scores, format, response);
+  return true;
+}
+
+metric_shard &server::shard_of(int idm) {
+  return MMetricShards[static_cast<unsigned>(idm) % NUM_METRIC_SHARDS];
+}
+
+metric_history &server::history_of(int idm) {
+  static const std::vector<rollup_tier_config> no_rollups;
+  auto &shard = shard_of(idm);
+  std::lock_guard<std::mutex> guard(shard.lock);
+  auto res = shard.buffers.find(idm);
+  if (res != shard.buffers.end())
+    return res->second;
+  ++MNumMetrics;
+  return shard.buffers
+      .try_emplace(idm, MHotWindow,
+                   reserve_rollups() ? MRollupTiers : no_rollups)
+      .first->second;
+}
+
+bool server::reserve_rollups() {
+  if (MRollupTiers.empty())
+    return false;
+  // a new metric takes its first samples right away, which allocates them
+  size_t bytes = rollup_memory_bytes(MRollupTiers);
+  size_t total = MRollupBytes.fetch_add(bytes) + bytes;
+  if (!MHistoryBudget || total <= MHistoryBudget / 2)
+    return true;
+  MRollupBytes -= bytes;
+  if (!MRollupBudgetWarned.exchange(true))
+    std::cerr << "rollups take half of history_memory_mb, metrics added from "
+                 "now on have none"
+              << std::endl;
+  return false;
+}
+
+metric_score server::calc_confidence_score(int idm,
+                                           const running_stats &stats) {
   auto round_2d = [](double value) { return round(value * 100.0) / 100.0; };
 
-  double average = do_average(deque);
-  double dispersion = do_dispersion(deque, average);
+  double average = stats.average();
+  double dispersion = stats.dispersion();
   double standard_deviation = sqrt(dispersion);
   // TODO: find difference between them, Note: for now, they remain equel!
   double sq_standard_deviation = standard_deviation;
 
-  json::object new_obj;
-  new_obj["_id"] = idm;
-
-  json::object r;
-  r["average"].emplace_double() = round_2d(average);
-  r["sq_standard_deviation"].emplace_double() = round_2d(sq_standard_deviation);
-  r["standard_deviation"].emplace_double() = round_2d(standard_deviation);
-  r["dispersion"].emplace_double() = round_2d(dispersion);
-  new_obj["result"] = r;
-  return new_obj;
+  metric_score score;
+  score.idm = idm;
+  score.average = round_2d(average);
+  score.sq_standard_deviation = round_2d(sq_standard_deviation);
+  score.standard_deviation = round_2d(standard_deviation);
+  score.dispersion = round_2d(dispersion);
+  return score;
 }
 
-json::value server::handle_data(const json::value &rdata) {
+metric_score server::handle_metric(int idm, const int *samples,
+                                   size_t count, bool skip_fft) {
   // To get the nearest number which is a power of two
   auto nearest_power_of_2 = [](size_t x) {
     return 1 << (long)(log(x) / log(2));
   };
 
-  json::array response;
-  for (auto elem : rdata.get_array()) {
-    // 1. Server aggregates received data
-    auto obj = elem.get_object();
-    int idm = obj["_id"].get_int64();
-    auto &deque = MMetricBuffer[idm];
-    auto newdata = obj["data"].get_array();
-
-    int extra_elems = (deque.size() + newdata.size()) - MAX_NUM_METRICS;
-    // deque.insert(deque.end(), newdata.begin(), newdata.end());
-    for (auto e : newdata)
-      deque.push_back(e.get_int64());
-
-    if (extra_elems > 0) {
-      deque.erase(deque.begin(), deque.begin() + extra_elems);
+  // 1. Server aggregates received data
+  metric_score score;
+  spectrum_ptr spectrum_result;
+  size_t history_size = 0;
+  size_t spent_ms = 0;
+  add_counter(counter::metrics);
+  {
+    auto &history = history_of(idm);
+    std::lock_guard<std::mutex> guard(history.lock);
+    auto &ring = history.samples;
+    auto aggregate_start = std::chrono::steady_clock::now();
+
+    size_t bytes_before = history.sample_bytes();
+    size_t buffer_bytes_before = history.memory_bytes();
+    auto leave_stats = [&history](const int *data, size_t size) {
+      for (size_t i = 0; i < size; ++i)
+        history.stats.remove(data[i]);
+    };
+
+    // the rollups and the received total see the whole batch
+    {
+      std::lock_guard<std::mutex> rollups_guard(history.rollups_lock);
+      history.rollups.add(aggregate_start, samples, count);
+    }
+    history.received += count;
+
+    // a batch longer than the whole window only keeps its tail
+    if (count > MAX_NUM_METRICS) {
+      samples += count - MAX_NUM_METRICS;
+      count = MAX_NUM_METRICS;
     }
-    // std::cout << "buffer[idm=" << idm << "] size: " << deque.size() <<
+
+    // the oldest samples leave the window, compressed ones first
+    size_t extra_elems = 0;
+    if (history.size() + count > MAX_NUM_METRICS)
+      extra_elems = history.size() + count - MAX_NUM_METRICS;
+    size_t extra_cold = std::min(extra_elems, history.cold.size());
+    history.cold.drop_front(extra_cold, leave_stats);
+
+    sample_span first, second;
+    ring.oldest(extra_elems - extra_cold, first, second);
+    for (auto span : {first, second})
+      leave_stats(span.data, span.size);
+    ring.drop_front(extra_elems - extra_cold);
+
+    // samples pushed out of the hot window are compressed, the head of a
+    // batch longer than the hot window goes there directly
+    size_t overflow = 0;
+    if (ring.size() + count > ring.window())
+      overflow = ring.size() + count - ring.window();
+    size_t spilled = std::min(overflow, ring.size());
+    ring.oldest(spilled, first, second);
+    for (auto span : {first, second})
+      history.cold.append(span.data, span.size);
+    ring.drop_front(spilled);
+    history.cold.append(samples, overflow - spilled);
+
+    ring.append(samples + overflow - spilled, count - (overflow - spilled));
+    for (size_t i = 0; i < count; ++i)
+      history.stats.add(samples[i]);
+
+    // Over the memory budget every metric shrinks to an even share of what
+    // the rollups leave as it takes new samples. Only compressed samples
+    // go, the FFT keeps its window.
+    size_t rollup_bytes = MRollupBytes.load(std::memory_order_relaxed);
+    size_t history_bytes = MHistoryBytes.load(std::memory_order_relaxed);
+    if (MHistoryBudget && history_bytes + rollup_bytes > MHistoryBudget) {
+      size_t share =
+          (MHistoryBudget - rollup_bytes) / std::max<size_t>(1, MNumMetrics);
+      while (history.cold.size() && history.sample_bytes() > share) {
+        size_t trimmed = std::min(history.cold.size(), HISTORY_BLOCK_SAMPLES);
+        history.cold.drop_front(trimmed, leave_stats);
+        add_counter(counter::history_trimmed, trimmed);
+      }
+      if (history.sample_bytes() > share &&
+          !MHistoryBudgetWarned.exchange(true))
+        std::cerr << "history_memory_mb leaves " << share
+                  << " bytes per metric, less than the hot window takes: "
+                     "stats only cover the FFT window"
+                  << std::endl;
+    }
+    MHistoryBytes += history.sample_bytes() - bytes_before;
+    // std::cout << "buffer[idm=" << idm << "] size: " << ring.size() <<
     // std::endl;
+    history_size = history.size();
+    record_latency(stage::aggregate,
+                   std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - aggregate_start)
+                       .count());
 
     // 2. Server calculates the confidence score of the data
-    auto metric_score = calc_confidence_score(idm, deque);
-    response.push_back(metric_score);
-
-    // 3. Server executes FFT
-    size_t n = nearest_power_of_2(deque.size());
-    // get last n elements from buffer
-    std::vector<int> arr(deque.end() - n, deque.end());
-    auto start_time = std::chrono::high_resolution_clock::now();
-    auto spectrum_result = calculate_fft(arr);
-    auto end_time = std::chrono::high_resolution_clock::now();
-    typedef std::chrono::milliseconds ms;
-    size_t spent_ms =
-        std::chrono::duration_cast<ms>(end_time - start_time).count();
-
     {
-      // 4. Server prints calculation results
-      auto res = metric_score.get_object()["result"].get_object();
-      double average = res["average"].as_double();
-      double sq_standard_deviation = res["sq_standard_deviation"].as_double();
-      double standard_deviation = res["standard_deviation"].as_double();
-      double dispersion = res["dispersion"].as_double();
-
-      const std::string sep = "; ";
-      std::stringstream ss;
-      ss << idm << sep << newdata.size() << sep << deque.size() << sep
-         << average << sep << sq_standard_deviation << sep << standard_deviation
-         << sep << dispersion << sep << spent_ms << std::endl;
-      write(STDOUT_FILENO, ss.str().c_str(), ss.str().length());
+      stage_timer timer(stage::stats);
+      score = calc_confidence_score(idm, history.stats);
     }
 
-    if (MNeedSaveData) {
-      // 5. Server saves the spectrum to file
-      json::array rdata(spectrum_result.begin(), spectrum_result.end());
-      save_data_to_file(idm, rdata);
+    // 3. Server executes FFT over the last n elements of the buffer, in
+    // place. A full transform only runs once every MFftHop new samples, in
+    // between the spectrum of the previous one is reused. A shed request
+    // leaves it to the next one.
+    history.samples_since_fft += count;
+    if (!skip_fft &&
+        (!history.spectrum || history.samples_since_fft >= MFftHop)) {
+      size_t n = ring.size() ? nearest_power_of_2(ring.size()) : 0;
+      if (MFftWindow)
+        n = std::min(n, MFftWindow);
+      ring.latest(n, first, second);
+      auto start_time = std::chrono::high_resolution_clock::now();
+      history.spectrum =
+          std::make_shared<std::vector<int>>(calculate_fft(first, second));
+      auto end_time = std::chrono::high_resolution_clock::now();
+      typedef std::chrono::milliseconds ms;
+      spent_ms =
+          std::chrono::duration_cast<ms>(end_time - start_time).count();
+      record_latency(stage::fft,
+                     std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         end_time - start_time)
+                         .count());
+      history.samples_since_fft = 0;
+
+      // an unchanged spectrum is not saved again
+      if (MNeedSaveData)
+        spectrum_result = history.spectrum;
     }
+    MBufferBytes += history.memory_bytes() - buffer_bytes_before;
   }
-  return response;
-}
 
-void server::send_to_client(int client_fd, const json::value &value_to_send) {
-  static uint64_t sent_msgs_count = 0;
-  // std::cout << "Try to send Msg#: " << sent_msgs_count << std::endl;
-  std::stringstream ss;
-  pretty_print(ss, value_to_send);
-  const auto &str = ss.str();
-  // std::cout << "Sending message: " << str << std::endl;
-  write(client_fd, str.c_str(), str.length());
-  // std::cout << "the message has been sent!"
-  //              " total sent msgs:" << ++sent_msgs_count << std::endl;
-}
+  if (MResultLog) {
+    // 4. Server logs calculation results
+    result_record record;
+    record.idm = idm;
+    record.count = count;
+    record.history_size = history_size;
+    record.average = score.average;
+    record.sq_standard_deviation = score.sq_standard_deviation;
+    record.standard_deviation = score.standard_deviation;
+    record.dispersion = score.dispersion;
+    record.spent_ms = spent_ms;
+    MResultLog->append(record);
+  }
 
-void server::save_data_to_file(int idm, const json::value &data) {
-  auto cfg = MConfig.get_object();
-  auto log_dir = json::serialize(cfg["path_to_folder_of_log"].get_string());
-  log_dir.erase(std::remove(log_dir.begin(), log_dir.end(), '\"'),
-                log_dir.end());
-
-  std::filesystem::path path(log_dir);
-  std::stringstream filename;
-  filename << idm << "_"
-           << "spectrum"
-           << ".txt";
-  path /= filename.str();
-
-  int fd = -1;
-  auto res = MFilename2FdMap.find(path.native());
-  if (res != MFilename2FdMap.end()) {
-    fd = res->second;
-  } else {
-    fd = open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_NONBLOCK,
-              S_IRUSR | S_IWUSR);
-    if (fd == -1) {
-      perror("open() failed");
-      exit(EXIT_FAILURE);
-    }
-    MFilename2FdMap[path.native()] = fd;
+  if (MSpectrumWriter && spectrum_result) {
+    // 5. Server hands the spectrum over to the background writer
+    MSpectrumWriter->submit(idm, std::move(spectrum_result));
   }
-  // std::cout << "Save data to file: " << path.c_str() << std::endl;
-  std::stringstream ss;
-  pretty_print(ss, data);
-  pwrite(fd, ss.str().c_str(), ss.str().size(), 0);
-  // close(fd);
+  return score;
 }
 
-static void FFT_analysis(const std::vector<int> &AVal, std::vector<int> &FTvl,
-                         int Nvl, int Nft) {
-  // https://ru.wikibooks.org/wiki/Реализации_алгоритмов/Быстрое_преобразование_Фурье
-  const double TwoPi = 6.283185307179586;
-  int i, j, n, m, Mmax, Istp;
-  double Tmpr, Tmpi, Wtmp, Theta;
-  double Wpr, Wpi, Wr, Wi;
-  double *Tmvl;
-
-  n = Nvl * 2;
-  Tmvl = new double[n];
-
-  for (i = 0; i < n; i += 2) {
-    Tmvl[i] = 0;
-    Tmvl[i + 1] = AVal[i / 2];
+bool server::handle_data(const char *data, size_t size,
+                         std::vector<metric_score> &scores, bool skip_fft) {
+  // the text goes straight into a flat batch, no DOM is built
+  thread_local metric_batch batch;
+  {
+    stage_timer timer(stage::parse);
+    if (!scan_metrics_json(data, size, batch))
+      return false;
   }
 
-  i = 1;
-  j = 1;
-  while (i < n) {
-    if (j > i) {
-      Tmpr = Tmvl[i];
-      Tmvl[i] = Tmvl[j];
-      Tmvl[j] = Tmpr;
-      Tmpr = Tmvl[i + 1];
-      Tmvl[i + 1] = Tmvl[j + 1];
-      Tmvl[j + 1] = Tmpr;
-    }
-    i = i + 2;
-    m = Nvl;
-    while ((m >= 2) && (j > m)) {
-      j = j - m;
-      m = m >> 1;
-    }
-    j = j + m;
-  }
+  for (const auto &metric : batch.metrics)
+    scores.push_back(handle_metric(metric.idm,
+                                   batch.samples.data() + metric.offset,
+                                   metric.count, skip_fft));
+  return true;
+}
 
-  Mmax = 2;
-  while (n > Mmax) {
-    Theta = -TwoPi / Mmax;
-    Wpi = sin(Theta);
-    Wtmp = sin(Theta / 2);
-    Wpr = Wtmp * Wtmp * 2;
-    Istp = Mmax * 2;
-    Wr = 1;
-    Wi = 0;
-    m = 1;
-
-    while (m < Mmax) {
-      i = m;
-      m = m + 2;
-      Tmpr = Wr;
-      Tmpi = Wi;
-      Wr = Wr - Tmpr * Wpr - Tmpi * Wpi;
-      Wi = Wi + Tmpr * Wpi - Tmpi * Wpr;
-
-      while (i < n) {
-        j = i + Mmax;
-        Tmpr = Wr * Tmvl[j] - Wi * Tmvl[j - 1];
-        Tmpi = Wi * Tmvl[j] + Wr * Tmvl[j - 1];
-
-        Tmvl[j] = Tmvl[i] - Tmpr;
-        Tmvl[j - 1] = Tmvl[i - 1] - Tmpi;
-        Tmvl[i] = Tmvl[i] + Tmpr;
-        Tmvl[i - 1] = Tmvl[i - 1] + Tmpi;
-        i = i + Istp;
-      }
-    }
+bool server::handle_binary_data(const char *data, size_t size,
+                                std::vector<metric_score> &scores,
+                                bool skip_fft) {
+  // misaligned samples are copied here, the buffer is reused across calls
+  thread_local std::vector<int> scratch;
+  scratch.clear();
+  return decode_metrics(data, size, scratch,
+                        [&](int idm, const int *samples, size_t count) {
+                          scores.push_back(
+                              handle_metric(idm, samples, count, skip_fft));
+                        });
+}
 
-    Mmax = Istp;
+void server::encode_response(const std::vector<metric_score> &scores,
+                             wire_format format, std::string &str) {
+  str.clear();
+  if (format == wire_format::binary) {
+    encode_scores(str, scores);
+  } else if (MPrettyPrint) {
+    json::array value_to_send;
+    value_to_send.reserve(scores.size());
+    for (const auto &score : scores)
+      value_to_send.push_back(score_to_json(score));
+
+    std::stringstream ss;
+    pretty_print(ss, value_to_send);
+    str = ss.str();
+  } else {
+    encode_scores_json(str, scores);
   }
+}
 
-  for (i = 0; i < Nft; i++) {
-    j = i * 2;
-    FTvl[i] = 2 * sqrt(pow(Tmvl[j], 2) + pow(Tmvl[j + 1], 2)) / Nvl;
-  }
-  delete[] Tmvl;
+void server::send_to_client(client_connection &conn, std::string str) {
+  static uint64_t sent_msgs_count = 0;
+  // std::cout << "Try to send Msg#: " << sent_msgs_count << std::endl;
+  // std::cout << "Sending message: " << str << std::endl;
+  // queued only, the reactor flushes everything pending with one sendmsg()
+  conn.writer.push(std::move(str));
+  // std::cout << "the message has been sent!"
+  //              " total sent msgs:" << ++sent_msgs_count << std::endl;
 }
 
-std::vector<int> server::calculate_fft(const std::vector<int> &AVal) {
-  std::vector<int> FTvl(AVal.size(), 0);
+std::vector<int> server::calculate_fft(const sample_span &first,
+                                       const sample_span &second) {
+  size_t size = first.size + second.size;
+  std::vector<int> FTvl(size, 0);
+
+  // plans are shared, scratch buffers belong to the calling reactor thread
+  thread_local fft_engine engine;
 
   auto is_power_of_two = [](int v) -> bool { return v && !(v & (v - 1)); };
-  if (is_power_of_two(AVal.size()))
-    FFT_analysis(AVal, FTvl, AVal.size(), AVal.size());
+  if (is_power_of_two(size))
+    engine.magnitudes(first, second, FTvl.data());
 
   // std::cout << "calculate_fft for size: " << FTvl.size() << std::endl;
   // for (auto e: FTvl) std::cout << e << ",";
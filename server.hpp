@@ -1,16 +1,154 @@
 #ifndef __SERVER_HPP__
 #define __SERVER_HPP__
 
+#include "compressed_history.hpp"
+#include "frame.hpp"
+#include "protocol.hpp"
+#include "result_log.hpp"
+#include "rollup.hpp"
+#include "running_stats.hpp"
+#include "sample_ring.hpp"
+#include "server_stats.hpp"
+#include "spectrum_writer.hpp"
+#include "thread_pool.hpp"
+#include "timer_wheel.hpp"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <boost/json.hpp>
 #include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
 namespace json = boost::json;
 using Config = json::value;
 
+const int MAX_NUM_METRICS = 1'000'000;
+
+// Every _id is owned by exactly one shard (idm % NUM_METRIC_SHARDS), so
+// reactors working on different metrics never contend on the same lock.
+const int NUM_METRIC_SHARDS = 64;
+
+// resolution of the reactors' idle timeouts and periodic work
+const std::chrono::milliseconds TIMER_TICK(10);
+// how long a reactor stops accepting when accept fails for want of
+// descriptors, on io_uring after any unexpected accept error
+const std::chrono::milliseconds ACCEPT_BACKOFF(100);
+// an admin client that hasn't taken its snapshot by then is dropped
+const std::chrono::seconds ADMIN_SEND_TIMEOUT(1);
+
+// accept() errors that fail again right away until descriptors are freed
+inline bool is_out_of_descriptors(int error) {
+  return error == EMFILE || error == ENFILE || error == ENOBUFS ||
+         error == ENOMEM;
+}
+
+// The shard lock only guards the map, every metric has its own lock, so
+// metrics of one shard are still processed in parallel. The window of
+// MAX_NUM_METRICS samples is split in two: the latest hot_window samples
+// stay raw for the FFT, older ones are only needed to leave the stats again
+// and are kept compressed.
+struct metric_history {
+  metric_history(size_t hot_window,
+                 const std::vector<rollup_tier_config> &rollup_tiers)
+      : samples(hot_window), rollups(rollup_tiers) {}
+
+  inline size_t size() const { return samples.size() + cold.size(); }
+
+  // raw and compressed samples, what history_memory_mb limits
+  inline size_t sample_bytes() const {
+    return samples.capacity() * sizeof(int) + cold.memory_bytes();
+  }
+
+  inline size_t memory_bytes() const {
+    return sample_bytes() + rollups.memory_bytes() +
+           (spectrum ? spectrum->capacity() * sizeof(int) : 0);
+  }
+
+  // held across the FFT
+  std::mutex lock;
+  sample_ring samples;
+  compressed_history cold;
+  running_stats stats;
+  // Downsampled history that outlives the raw window. Updated under both
+  // locks, the admin snapshot reads it under rollups_lock alone, which is
+  // only ever held briefly.
+  std::mutex rollups_lock;
+  metric_rollups rollups;
+  // samples taken so far, read without a lock
+  std::atomic<uint64_t> received{0};
+  spectrum_ptr spectrum;
+  size_t samples_since_fft = 0;
+};
+
+struct metric_shard {
+  std::mutex lock;
+  std::unordered_map<int, metric_history> buffers;
+};
+
+// A request waiting for the worker pool
+struct pending_request {
+  std::string data;
+  // when its last byte was read, the latency budget counts from here
+  std::chrono::steady_clock::time_point arrived;
+};
+
+// State of one client connection, owned by the reactor that accepted it.
+// The socket is edge-triggered and epoll_event.data.ptr points here.
+struct client_connection {
+  // -1 once closed
+  int fd = -1;
+  uint64_t id = 0;
+  // An admin client only takes its snapshot, queued in the writer, and is
+  // closed once that is sent
+  bool admin = false;
+  frame_reader reader;
+  frame_writer writer;
+  // the socket may hold unread input: set by EPOLLIN, cleared on EAGAIN
+  bool readable = false;
+  // The peer shut down its side after sending. Its last requests are still
+  // answered, the connection closes once nothing is left to do.
+  bool read_closed = false;
+  // complete frames were left over after the turn's message budget
+  bool throttled = false;
+  // waiting in the reactor's ready list for another turn
+  bool queued = false;
+  // requests waiting for the worker pool, they are processed one at a time
+  std::deque<pending_request> pending;
+  bool busy = false;
+
+  uint64_t bytes_read = 0;
+  uint64_t bytes_written = 0;
+  uint64_t requests = 0;
+  std::chrono::steady_clock::time_point connected_at;
+  std::chrono::steady_clock::time_point last_active;
+  // evicts the connection once it has been idle for idle_timeout_ms
+  timer idle_timer;
+};
+
+// A response finished by a worker, on its way back to the owning reactor
+struct completed_request {
+  uint64_t connection_id;
+  std::string response;
+};
+
+// epoll is the default, io_uring falls back to it where the kernel lacks it
+enum class io_backend { epoll, io_uring };
+
+struct reactor_mailbox {
+  int eventfd;
+  std::mutex lock;
+  std::vector<completed_request> done;
+};
+
 class server {
+  // bench.cpp measures the private hot paths directly
+  friend class server_bench;
+
 public:
   server() = default;
 
@@ -23,25 +161,124 @@ public:
   bool run();
 
 private:
-  void start_listening();
+  int start_listening(uint64_t listen_port);
+
+  void run_backend(int listen_sock);
+
+  void run_reactor(int listen_sock);
+
+  // False if io_uring can't be set up, the caller then runs run_reactor()
+  bool run_uring_reactor(int listen_sock);
+
+  bool receive_from_client(client_connection &conn);
+
+  bool service_connection(client_connection &conn, reactor_mailbox &mailbox);
+
+  bool flush_to_client(client_connection &conn);
+
+  // The snapshot every admin client accepted in this wakeup gets
+  std::string admin_reply();
+
+  json::object admin_snapshot();
+
+  bool is_backlogged(const client_connection &conn) const;
+
+  // A half-closed connection that has no requests or responses left
+  bool is_finished(const client_connection &conn) const;
+
+  // When conn counts as idle if nothing happens meanwhile. A connection
+  // with requests or responses still queued is never idle.
+  std::chrono::steady_clock::time_point
+  idle_deadline(const client_connection &conn,
+                std::chrono::steady_clock::time_point now) const;
+
+  void log_stats();
+
+  void handle_frames(client_connection &conn, reactor_mailbox &mailbox);
+
+  void dispatch_pending(client_connection &conn, reactor_mailbox &mailbox);
+
+  // Fills response with the scores, or with an error when the request
+  // can't be parsed, which returns false
+  bool process_request(const char *data, size_t size,
+                       std::chrono::steady_clock::time_point arrived,
+                       std::string &response);
+
+  metric_shard &shard_of(int idm);
+
+  metric_history &history_of(int idm);
+
+  // Whether a new metric may have rollups, counts their memory if so
+  bool reserve_rollups();
+
+  metric_score calc_confidence_score(int idm, const running_stats &stats);
 
-  std::string receive_from_client(int client_fd, int epollfd);
+  metric_score handle_metric(int idm, const int *samples, size_t count,
+                             bool skip_fft);
 
-  json::value calc_confidence_score(int idm, const std::deque<int> &deque);
+  bool handle_data(const char *data, size_t size,
+                   std::vector<metric_score> &scores, bool skip_fft);
 
-  json::value handle_data(const json::value &rdata);
+  bool handle_binary_data(const char *data, size_t size,
+                          std::vector<metric_score> &scores, bool skip_fft);
 
-  void send_to_client(int client_fd, const json::value &value_to_send);
+  void encode_response(const std::vector<metric_score> &scores,
+                       wire_format format, std::string &str);
 
-  std::vector<int> calculate_fft(const std::vector<int> &AVal);
+  void send_to_client(client_connection &conn, std::string str);
 
-  void save_data_to_file(int idm, const json::value &data);
+  std::vector<int> calculate_fft(const sample_span &first,
+                                 const sample_span &second);
 
-  int MListenSock;
+  std::vector<int> MListenSocks;
+  // serves stats snapshots, -1 when no admin_port is configured
+  int MAdminSock = -1;
   Config MConfig;
+  io_backend MIoBackend = io_backend::epoll;
   bool MNeedSaveData = false;
-  std::unordered_map<int, std::deque<int>> MMetricBuffer;
-  std::unordered_map<std::string, int> MFilename2FdMap;
+  // indented JSON for debugging, compact output otherwise
+  bool MPrettyPrint = false;
+  // 0 keeps the legacy window: the largest power of two of the history
+  size_t MFftWindow = 0;
+  size_t MFftHop = 1;
+  // Admission control. A connection gets at most this much input and this
+  // many requests per turn before the next ready one is served.
+  size_t MMaxReadPerTurn = 1024 * 1024;
+  size_t MMaxMessagesPerTurn = 32;
+  // a request that waited longer is answered without running the FFT, 0
+  // turns shedding off
+  std::chrono::nanoseconds MLatencyBudget{0};
+  // 0 keeps idle connections open forever
+  std::chrono::milliseconds MIdleTimeout{0};
+  // the first reactor logs a stats snapshot this often, 0 turns it off
+  std::chrono::milliseconds MStatsInterval{0};
+  // samples kept raw per metric, the whole window unless history
+  // compression is on
+  size_t MHotWindow = MAX_NUM_METRICS;
+  // Bytes the samples and rollups of all histories may take, 0 for no
+  // limit. Over the budget a metric gives up its oldest compressed samples
+  // down to an even share of what the rollups leave. Rollups have a fixed
+  // size and can't be trimmed, so they get at most half the budget and
+  // metrics added past that have none.
+  size_t MHistoryBudget = 0;
+  std::atomic<size_t> MHistoryBytes{0};
+  std::atomic<size_t> MRollupBytes{0};
+  // logged once: new metrics go without rollups
+  std::atomic<bool> MRollupBudgetWarned{false};
+  // metric_history::memory_bytes() of all metrics, for the admin snapshot
+  std::atomic<size_t> MBufferBytes{0};
+  // logged once: a share too small to keep anything but the hot window
+  std::atomic<bool> MHistoryBudgetWarned{false};
+  std::atomic<size_t> MNumMetrics{0};
+  // the admin snapshot shows the rollups of this many busiest metrics
+  size_t MAdminRollupMetrics = 16;
+  // every metric rolls its samples up into these tiers, finest first
+  std::vector<rollup_tier_config> MRollupTiers{
+      {std::chrono::seconds(1), 3600}, {std::chrono::minutes(1), 1440}};
+  std::array<metric_shard, NUM_METRIC_SHARDS> MMetricShards;
+  std::unique_ptr<spectrum_writer> MSpectrumWriter;
+  std::unique_ptr<result_log> MResultLog;
+  std::unique_ptr<thread_pool> MWorkers;
 };
 
 #endif /* __SERVER_HPP__ */
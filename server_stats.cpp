@@ -0,0 +1,143 @@
+#include "server_stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Log-linear buckets as in HDR histograms: values below 16 ns get a bucket
+// each, every power of two above is split into 16 sub-buckets, so a bucket
+// is at most 1/16 of its value wide.
+const unsigned SUB_BUCKET_BITS = 4;
+const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+const size_t HISTOGRAM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+static const char *STAGE_NAMES[NUM_STAGES] = {
+    "read", "parse", "aggregate", "stats",
+    "fft",  "serialize", "write", "persist"};
+
+static const char *COUNTER_NAMES[NUM_COUNTERS] = {
+    "connections_accepted", "connections_closed", "connections_evicted",
+    "messages",             "metrics",            "bytes_read",
+    "bytes_written",        "parse_failures",     "syscalls",
+    "shed_requests",        "history_trimmed"};
+
+static size_t bucket_of(uint64_t value) {
+  if (value < SUB_BUCKETS)
+    return value;
+  unsigned exponent = 63 - __builtin_clzll(value);
+  unsigned shift = exponent - SUB_BUCKET_BITS;
+  return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+// middle of the range of values that fall into a bucket
+static double bucket_value(size_t bucket) {
+  if (bucket < SUB_BUCKETS)
+    return bucket;
+  unsigned shift = bucket / SUB_BUCKETS - 1;
+  uint64_t lower = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+  return lower + ((uint64_t(1) << shift) - 1) / 2.0;
+}
+
+namespace {
+
+struct thread_stats {
+  std::atomic<uint64_t> buckets[NUM_STAGES][HISTOGRAM_BUCKETS];
+  std::atomic<uint64_t> sum[NUM_STAGES];
+  std::atomic<uint64_t> max[NUM_STAGES];
+  std::atomic<uint64_t> counters[NUM_COUNTERS];
+};
+
+// the only writer of a block is its thread, a plain load and store is enough
+inline void bump(std::atomic<uint64_t> &value, uint64_t delta) {
+  value.store(value.load(std::memory_order_relaxed) + delta,
+              std::memory_order_relaxed);
+}
+
+std::mutex registry_lock;
+// blocks outlive their threads, so nothing recorded is lost
+std::vector<std::unique_ptr<thread_stats>> registry;
+
+thread_stats &local_stats() {
+  thread_local thread_stats *stats = nullptr;
+  if (!stats) {
+    std::lock_guard<std::mutex> guard(registry_lock);
+    registry.emplace_back(new thread_stats());
+    stats = registry.back().get();
+  }
+  return *stats;
+}
+
+} // namespace
+
+void record_latency(stage s, uint64_t nanoseconds) {
+  auto &stats = local_stats();
+  size_t index = static_cast<size_t>(s);
+  bump(stats.buckets[index][bucket_of(nanoseconds)], 1);
+  bump(stats.sum[index], nanoseconds);
+  if (nanoseconds > stats.max[index].load(std::memory_order_relaxed))
+    stats.max[index].store(nanoseconds, std::memory_order_relaxed);
+}
+
+void add_counter(counter c, uint64_t value) {
+  bump(local_stats().counters[static_cast<size_t>(c)], value);
+}
+
+json::object stats_snapshot() {
+  std::vector<uint64_t> buckets(HISTOGRAM_BUCKETS);
+  uint64_t sum[NUM_STAGES] = {0};
+  uint64_t max[NUM_STAGES] = {0};
+  uint64_t counters[NUM_COUNTERS] = {0};
+
+  json::object stages;
+  std::lock_guard<std::mutex> guard(registry_lock);
+  for (const auto &stats : registry) {
+    for (size_t i = 0; i < NUM_STAGES; ++i) {
+      sum[i] += stats->sum[i].load(std::memory_order_relaxed);
+      max[i] = std::max(max[i], stats->max[i].load(std::memory_order_relaxed));
+    }
+    for (size_t i = 0; i < NUM_COUNTERS; ++i)
+      counters[i] += stats->counters[i].load(std::memory_order_relaxed);
+  }
+
+  for (size_t i = 0; i < NUM_STAGES; ++i) {
+    std::fill(buckets.begin(), buckets.end(), 0);
+    uint64_t count = 0;
+    for (const auto &stats : registry)
+      for (size_t b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+        uint64_t n = stats->buckets[i][b].load(std::memory_order_relaxed);
+        buckets[b] += n;
+        count += n;
+      }
+
+    auto percentile = [&](double fraction) -> double {
+      uint64_t rank = fraction * count;
+      uint64_t seen = 0;
+      for (size_t b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+        seen += buckets[b];
+        if (seen > rank)
+          return bucket_value(b) / 1000;
+      }
+      return max[i] / 1000.0;
+    };
+
+    json::object stage;
+    stage["count"] = count;
+    stage["mean_us"] = count ? sum[i] / 1000.0 / count : 0.0;
+    stage["max_us"] = max[i] / 1000.0;
+    stage["p50_us"] = percentile(0.5);
+    stage["p90_us"] = percentile(0.9);
+    stage["p99_us"] = percentile(0.99);
+    stage["p999_us"] = percentile(0.999);
+    stages[STAGE_NAMES[i]] = std::move(stage);
+  }
+
+  json::object counter_values;
+  for (size_t i = 0; i < NUM_COUNTERS; ++i)
+    counter_values[COUNTER_NAMES[i]] = counters[i];
+
+  json::object result;
+  result["counters"] = std::move(counter_values);
+  result["stages"] = std::move(stages);
+  return result;
+}
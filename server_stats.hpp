@@ -0,0 +1,72 @@
+#ifndef __SERVER_STATS_HPP__
+#define __SERVER_STATS_HPP__
+
+#include <boost/json.hpp>
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace json = boost::json;
+
+// Pipeline stages with a latency histogram each
+enum class stage {
+  read,
+  parse,
+  aggregate,
+  stats,
+  fft,
+  serialize,
+  write,
+  persist,
+};
+const size_t NUM_STAGES = 8;
+
+enum class counter {
+  connections_accepted,
+  connections_closed,
+  // closed by the server after idle_timeout_ms without traffic
+  connections_evicted,
+  messages,
+  metrics,
+  bytes_read,
+  bytes_written,
+  parse_failures,
+  // reactor I/O calls: epoll_wait/accept/read/sendmsg, or io_uring_enter
+  syscalls,
+  // requests answered without the FFT, they exceeded the latency budget
+  shed_requests,
+  // compressed samples dropped early to stay within history_memory_mb
+  history_trimmed,
+};
+const size_t NUM_COUNTERS = 11;
+
+// Every thread records into its own block, registered on first use. The hot
+// path only does relaxed loads and stores on memory no other thread writes,
+// stats_snapshot() sums the blocks of all threads.
+void record_latency(stage s, uint64_t nanoseconds);
+
+void add_counter(counter c, uint64_t value = 1);
+
+// {"counters": {...}, "stages": {"fft": {"count", "mean_us", "max_us",
+// "p50_us", "p90_us", "p99_us", "p999_us"}, ...}}
+json::object stats_snapshot();
+
+// Records the time from construction to destruction for one stage
+class stage_timer {
+public:
+  explicit stage_timer(stage s)
+      : MStage(s), MStart(std::chrono::steady_clock::now()) {}
+
+  ~stage_timer() {
+    auto elapsed = std::chrono::steady_clock::now() - MStart;
+    record_latency(
+        MStage,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+private:
+  stage MStage;
+  std::chrono::steady_clock::time_point MStart;
+};
+
+#endif /* __SERVER_STATS_HPP__ */
@@ -0,0 +1,427 @@
+#include "server.hpp"
+#include "io_ring.hpp"
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// submission queue slots, the completion queue gets twice as many
+const unsigned URING_ENTRIES = 4096;
+// provided buffers multishot recv picks from, shared by all connections
+const uint16_t RECV_BUFFER_GROUP = 0;
+const unsigned RECV_BUFFER_COUNT = 1024;
+const unsigned RECV_BUFFER_SIZE = 16 * 1024;
+
+// user_data of the reactor's own requests. Anything else is a
+// uring_connection pointer with the operation in its low bits.
+enum : uint64_t {
+  ACCEPT_DATA = 1,
+  ADMIN_DATA = 2,
+  MAILBOX_DATA = 3,
+  ADMIN_REMOVE_DATA = 4
+};
+enum : uint64_t { RECV_OP = 0, SEND_OP = 1, CANCEL_OP = 2, OP_MASK = 3 };
+
+// A connection driven by completions instead of readiness
+struct uring_connection : client_connection {
+  // requests the kernel still holds, a closed connection is freed once the
+  // last of them completes
+  unsigned in_flight = 0;
+  bool recv_armed = false;
+  bool recv_cancelled = false;
+  bool sending = false;
+  bool closed = false;
+  // the kernel reads them while the send is in flight
+  struct iovec iov[MAX_WRITE_IOV];
+  struct msghdr msg;
+};
+
+// what the reactor submits, multishot accept and recv are tested apart
+const uint8_t URING_OPCODES[] = {
+    IORING_OP_ACCEPT,     IORING_OP_RECV,        IORING_OP_SENDMSG,
+    IORING_OP_POLL_ADD,   IORING_OP_POLL_REMOVE, IORING_OP_ASYNC_CANCEL,
+    IORING_OP_READ};
+
+bool server::run_uring_reactor(int listen_sock) {
+  io_ring ring;
+  if (!ring.init(URING_ENTRIES) ||
+      !ring.setup_buffers(RECV_BUFFER_GROUP, RECV_BUFFER_COUNT,
+                          RECV_BUFFER_SIZE)) {
+    perror("io_uring setup failed");
+    return false;
+  }
+  for (uint8_t opcode : URING_OPCODES) {
+    if (!ring.supports(opcode)) {
+      std::cerr << "io_uring lacks opcode " << int(opcode)
+                << ", using epoll" << std::endl;
+      return false;
+    }
+  }
+  // Multishot recv came with 6.0, after multishot accept and provided
+  // buffer rings, so a kernel that has it has all of them
+  if (!ring.supports_multishot_recv(RECV_BUFFER_GROUP)) {
+    std::cerr << "io_uring lacks multishot recv, using epoll" << std::endl;
+    return false;
+  }
+
+  // Blocking descriptors: io_uring waits for them in the kernel, a
+  // nonblocking one would complete with -EAGAIN instead
+  reactor_mailbox mailbox;
+  mailbox.eventfd = eventfd(0, 0);
+  if (mailbox.eventfd == -1) {
+    perror("eventfd() failed");
+    exit(EXIT_FAILURE);
+  }
+  uint64_t mailbox_counter = 0;
+
+  std::unordered_map<uint64_t, std::unique_ptr<uring_connection>> connections;
+  // closed connections with requests still in the kernel
+  std::unordered_map<uring_connection *, std::unique_ptr<uring_connection>>
+      closing;
+  // connections that used up their message budget with frames left
+  std::vector<uint64_t> ready;
+  uint64_t next_connection_id = 0;
+
+  // idle timeouts and periodic work, the ring waits until the next one
+  timer_wheel timers(TIMER_TICK);
+  auto now = std::chrono::steady_clock::now();
+
+  auto user_data = [](uring_connection &conn, uint64_t op) {
+    return reinterpret_cast<uint64_t>(&conn) | op;
+  };
+
+  auto arm_accept = [&]() {
+    io_uring_sqe *sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_sock;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = ACCEPT_DATA;
+  };
+
+  timer accept_timer(arm_accept);
+
+  // set while out of descriptors, the admin poll is off until the timer
+  bool admin_paused = false;
+  auto arm_admin = [&]() {
+    io_uring_sqe *sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = MAdminSock;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = ADMIN_DATA;
+  };
+  timer admin_accept_timer([&]() {
+    admin_paused = false;
+    arm_admin();
+  });
+
+  auto arm_mailbox = [&]() {
+    io_uring_sqe *sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = mailbox.eventfd;
+    sqe->addr = reinterpret_cast<uint64_t>(&mailbox_counter);
+    sqe->len = sizeof(mailbox_counter);
+    sqe->user_data = MAILBOX_DATA;
+  };
+
+  // one multishot recv per connection, it stays armed until it fails or
+  // the connection is backlogged
+  auto arm_recv = [&](uring_connection &conn) {
+    io_uring_sqe *sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BUFFER_GROUP;
+    sqe->user_data = user_data(conn, RECV_OP);
+    conn.recv_armed = true;
+    ++conn.in_flight;
+  };
+
+  auto cancel_recv = [&](uring_connection &conn) {
+    io_uring_sqe *sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data(conn, RECV_OP);
+    sqe->user_data = user_data(conn, CANCEL_OP);
+    conn.recv_cancelled = true;
+    ++conn.in_flight;
+  };
+
+  // one send per connection at a time, with everything queued so far
+  auto send = [&](uring_connection &conn) {
+    memset(&conn.msg, 0, sizeof(conn.msg));
+    conn.msg.msg_iov = conn.iov;
+    conn.msg.msg_iovlen = conn.writer.prepare(conn.iov, MAX_WRITE_IOV);
+    io_uring_sqe *sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data(conn, SEND_OP);
+    conn.sending = true;
+    ++conn.in_flight;
+  };
+
+  // Frees the connection right away if the kernel holds nothing of it,
+  // the caller must not touch it afterwards
+  auto close_connection = [&](uring_connection &conn) {
+    timers.cancel(conn.idle_timer);
+    conn.closed = true;
+    if (!conn.admin)
+      add_counter(counter::connections_closed);
+    auto it = connections.find(conn.id);
+    std::unique_ptr<uring_connection> owner = std::move(it->second);
+    connections.erase(it);
+    if (conn.in_flight == 0) {
+      close(conn.fd);
+      add_counter(counter::syscalls);
+      return;
+    }
+    // fails whatever is in flight, the last completion frees it
+    shutdown(conn.fd, SHUT_RDWR);
+    add_counter(counter::syscalls);
+    closing[&conn] = std::move(owner);
+  };
+
+  auto service = [&](uring_connection &conn) {
+    handle_frames(conn, mailbox);
+    if (conn.reader.is_broken() || is_finished(conn)) {
+      close_connection(conn);
+      return;
+    }
+    if (!conn.sending && !conn.writer.empty())
+      send(conn);
+    // a backlogged client is not read from until it takes its responses,
+    // so TCP pushes back on it
+    bool backlogged = is_backlogged(conn);
+    if (backlogged && conn.recv_armed && !conn.recv_cancelled)
+      cancel_recv(conn);
+    else if (!backlogged && !conn.recv_armed && !conn.read_closed)
+      arm_recv(conn);
+    if (conn.throttled && !conn.queued && !backlogged) {
+      conn.queued = true;
+      ready.push_back(conn.id);
+    }
+  };
+
+  // An admin client gets the snapshot through its writer like any
+  // response. It's closed once that is sent, or after ADMIN_SEND_TIMEOUT.
+  auto accept_admins = [&]() {
+    std::string reply;
+    while (true) {
+      int admin_fd = accept4(MAdminSock, NULL, NULL, SOCK_CLOEXEC);
+      add_counter(counter::syscalls);
+      if (admin_fd == -1) {
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          return;
+        int error = errno;
+        perror("accept4() failed");
+        if (is_out_of_descriptors(error)) {
+          // the socket stays readable, the poll would fire again at once
+          admin_paused = true;
+          io_uring_sqe *sqe = ring.get_sqe();
+          sqe->opcode = IORING_OP_POLL_REMOVE;
+          sqe->fd = -1;
+          sqe->addr = ADMIN_DATA;
+          sqe->user_data = ADMIN_REMOVE_DATA;
+          timers.schedule(admin_accept_timer, now + ACCEPT_BACKOFF);
+        }
+        return;
+      }
+
+      // one snapshot for everyone who asked in this wakeup
+      if (reply.empty())
+        reply = admin_reply();
+      std::unique_ptr<uring_connection> conn(new uring_connection());
+      conn->fd = admin_fd;
+      conn->id = next_connection_id++;
+      conn->admin = true;
+      conn->writer.push_raw(reply);
+      uring_connection *ptr = conn.get();
+      conn->idle_timer.set_callback([&, ptr]() { close_connection(*ptr); });
+      timers.schedule(conn->idle_timer, now + ADMIN_SEND_TIMEOUT);
+      send(*conn);
+      connections[conn->id] = std::move(conn);
+    }
+  };
+
+  auto complete = [&](const io_uring_cqe &cqe) {
+    switch (cqe.user_data) {
+    case ACCEPT_DATA: {
+      if (cqe.res >= 0) {
+        std::unique_ptr<uring_connection> conn(new uring_connection());
+        conn->fd = cqe.res;
+        conn->id = next_connection_id++;
+        conn->connected_at = conn->last_active = now;
+        if (MIdleTimeout.count()) {
+          uring_connection *ptr = conn.get();
+          conn->idle_timer.set_callback([&, ptr]() {
+            auto deadline = idle_deadline(*ptr, now);
+            if (deadline > now) {
+              timers.schedule(ptr->idle_timer, deadline);
+              return;
+            }
+            add_counter(counter::connections_evicted);
+            close_connection(*ptr);
+          });
+          timers.schedule(conn->idle_timer, now + MIdleTimeout);
+        }
+        arm_recv(*conn);
+        connections[conn->id] = std::move(conn);
+        add_counter(counter::connections_accepted);
+      } else if (cqe.res != -ECONNABORTED && cqe.res != -EINTR) {
+        errno = -cqe.res;
+        perror("accept failed");
+      }
+      if (cqe.flags & IORING_CQE_F_MORE)
+        return;
+      // After a failure a new accept may well fail again right away, out
+      // of descriptors or for good, so it waits instead of spinning
+      if (cqe.res < 0 && cqe.res != -ECONNABORTED && cqe.res != -EINTR)
+        timers.schedule(accept_timer, now + ACCEPT_BACKOFF);
+      else
+        arm_accept();
+      return;
+    }
+    case ADMIN_DATA:
+      if (admin_paused)
+        return;
+      if (cqe.res >= 0)
+        accept_admins();
+      if (!(cqe.flags & IORING_CQE_F_MORE) && !admin_paused)
+        arm_admin();
+      return;
+    case ADMIN_REMOVE_DATA:
+      return;
+    case MAILBOX_DATA: {
+      std::vector<completed_request> done;
+      {
+        std::lock_guard<std::mutex> guard(mailbox.lock);
+        done.swap(mailbox.done);
+      }
+      for (auto &request : done) {
+        // the connection may be gone by now
+        auto it = connections.find(request.connection_id);
+        if (it == connections.end())
+          continue;
+        auto &conn = *it->second;
+        send_to_client(conn, std::move(request.response));
+        conn.busy = false;
+        service(conn);
+      }
+      arm_mailbox();
+      return;
+    }
+    }
+
+    auto &conn = *reinterpret_cast<uring_connection *>(cqe.user_data & ~OP_MASK);
+    bool failed = false;
+    switch (cqe.user_data & OP_MASK) {
+    case RECV_OP:
+      if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (!conn.closed) {
+          conn.reader.append(ring.buffer(bid), cqe.res, now);
+          add_counter(counter::bytes_read, cqe.res);
+          conn.bytes_read += cqe.res;
+          conn.last_active = now;
+        }
+        ring.recycle_buffer(bid);
+      }
+      if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        conn.recv_armed = false;
+        conn.recv_cancelled = false;
+        --conn.in_flight;
+      }
+      // the peer's EOF, its requests are still answered
+      if (cqe.res == 0)
+        conn.read_closed = true;
+      // out of buffers or cancelled for backpressure, service() re-arms
+      failed = cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED;
+      break;
+    case SEND_OP:
+      conn.sending = false;
+      --conn.in_flight;
+      if (cqe.res < 0) {
+        failed = true;
+      } else if (!conn.closed) {
+        conn.writer.consume(cqe.res);
+        add_counter(counter::bytes_written, cqe.res);
+        conn.bytes_written += cqe.res;
+      }
+      break;
+    case CANCEL_OP:
+      --conn.in_flight;
+      break;
+    }
+
+    if (conn.closed) {
+      if (conn.in_flight == 0) {
+        close(conn.fd);
+        add_counter(counter::syscalls);
+        closing.erase(&conn);
+      }
+      return;
+    }
+    if (failed) {
+      close_connection(conn);
+      return;
+    }
+    if (conn.admin) {
+      if (conn.writer.empty())
+        close_connection(conn);
+      else if (!conn.sending)
+        send(conn);
+      return;
+    }
+    service(conn);
+  };
+
+  arm_accept();
+  if (MAdminSock != -1 && listen_sock == MListenSocks[0])
+    arm_admin();
+  arm_mailbox();
+
+  timer stats_timer([&]() {
+    log_stats();
+    timers.schedule(stats_timer, now + MStatsInterval);
+  });
+  if (MStatsInterval.count() && listen_sock == MListenSocks[0])
+    timers.schedule(stats_timer, now + MStatsInterval);
+
+  // all I/O of a loop turn is submitted and reaped by one io_uring_enter()
+  uint64_t syscalls = 0;
+  std::vector<uint64_t> turn;
+  for (;;) {
+    turn.swap(ready);
+    int res = turn.empty() ? ring.submit_and_wait(1, timers.timeout_ms(now))
+                           : ring.submit_and_wait(0);
+    if (res == -1 && errno != EINTR) {
+      perror("io_uring_enter() failed");
+      exit(EXIT_FAILURE);
+    }
+    now = std::chrono::steady_clock::now();
+    ring.for_each_cqe(complete);
+    add_counter(counter::syscalls, ring.syscalls() - syscalls);
+    syscalls = ring.syscalls();
+
+    for (uint64_t id : turn) {
+      auto it = connections.find(id);
+      if (it == connections.end())
+        continue;
+      it->second->queued = false;
+      service(*it->second);
+    }
+    turn.clear();
+    timers.advance(now);
+  }
+
+  close(mailbox.eventfd);
+  return true;
+}
@@ -0,0 +1,126 @@
+#include "spectrum_store.hpp"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static_assert(sizeof(spectrum_file_header) <= SPECTRUM_DATA_OFFSET,
+              "spectrum header overlaps the bins");
+
+static size_t file_size_for(size_t capacity) {
+  return SPECTRUM_DATA_OFFSET + capacity * sizeof(int32_t);
+}
+
+bool read_spectrum(const void *mapping, size_t mapping_size,
+                   spectrum_file_header &header, std::vector<int> &bins) {
+  auto *shared = static_cast<const spectrum_file_header *>(mapping);
+  auto *data = static_cast<const char *>(mapping) + SPECTRUM_DATA_OFFSET;
+  if (mapping_size < SPECTRUM_DATA_OFFSET || shared->magic != SPECTRUM_MAGIC ||
+      shared->version != SPECTRUM_VERSION)
+    return false;
+
+  while (true) {
+    uint64_t seq = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+
+    header.magic = shared->magic;
+    header.version = shared->version;
+    header.capacity = __atomic_load_n(&shared->capacity, __ATOMIC_RELAXED);
+    header.size = __atomic_load_n(&shared->size, __ATOMIC_RELAXED);
+    header.timestamp_ns =
+        __atomic_load_n(&shared->timestamp_ns, __ATOMIC_RELAXED);
+    if (file_size_for(header.size) > mapping_size)
+      return false;
+    bins.resize(header.size);
+    memcpy(bins.data(), data, header.size * sizeof(int32_t));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&shared->sequence, __ATOMIC_RELAXED) == seq) {
+      header.sequence = seq;
+      return true;
+    }
+  }
+}
+
+spectrum_store::spectrum_store(const std::string &log_dir) : MLogDir(log_dir) {
+  if (!MLogDir.empty() && MLogDir.back() != '/')
+    MLogDir += '/';
+}
+
+spectrum_store::~spectrum_store() {
+  for (auto &elem : MFiles) {
+    munmap(elem.second.base, file_size_for(elem.second.capacity));
+    close(elem.second.fd);
+  }
+}
+
+spectrum_store::mapped_file &spectrum_store::file_of(int idm, size_t size) {
+  auto res = MFiles.find(idm);
+  if (res != MFiles.end() && res->second.capacity >= size)
+    return res->second;
+
+  if (res == MFiles.end()) {
+    std::string path = MLogDir + std::to_string(idm) + "_spectrum.bin";
+    int fd = open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+      perror("open() failed");
+      exit(EXIT_FAILURE);
+    }
+    res = MFiles.emplace(idm, mapped_file{fd, nullptr, 0}).first;
+  }
+
+  // grow to the next power of two, so a growing window remaps rarely
+  auto &file = res->second;
+  size_t capacity = 1;
+  while (capacity < size)
+    capacity <<= 1;
+  if (ftruncate(file.fd, file_size_for(capacity)) == -1) {
+    perror("ftruncate() failed");
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t sequence = 0;
+  if (file.base) {
+    sequence = reinterpret_cast<spectrum_file_header *>(file.base)->sequence;
+    munmap(file.base, file_size_for(file.capacity));
+  }
+  void *base = mmap(nullptr, file_size_for(capacity), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, file.fd, 0);
+  if (base == MAP_FAILED) {
+    perror("mmap() failed");
+    exit(EXIT_FAILURE);
+  }
+  file.base = static_cast<char *>(base);
+  file.capacity = capacity;
+
+  auto *header = reinterpret_cast<spectrum_file_header *>(file.base);
+  header->magic = SPECTRUM_MAGIC;
+  header->version = SPECTRUM_VERSION;
+  header->sequence = sequence;
+  __atomic_store_n(&header->capacity, capacity, __ATOMIC_RELEASE);
+  return file;
+}
+
+void spectrum_store::update(int idm, const int *bins, size_t size) {
+  auto &file = file_of(idm, size);
+  auto *header = reinterpret_cast<spectrum_file_header *>(file.base);
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  uint64_t seq = header->sequence;
+  __atomic_store_n(&header->sequence, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  memcpy(file.base + SPECTRUM_DATA_OFFSET, bins, size * sizeof(int32_t));
+  __atomic_store_n(&header->size, size, __ATOMIC_RELAXED);
+  __atomic_store_n(&header->timestamp_ns,
+                   uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec,
+                   __ATOMIC_RELAXED);
+
+  __atomic_store_n(&header->sequence, seq + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,62 @@
+#ifndef __SPECTRUM_STORE_HPP__
+#define __SPECTRUM_STORE_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Binary spectrum file $DIR/$IDM_spectrum.bin: a fixed header followed by
+// the bins as packed int32 at SPECTRUM_DATA_OFFSET. The file is mapped and
+// updated in place, readers map it too and take the latest spectrum without
+// syscalls or parsing.
+//
+// The header's sequence is a seqlock: it is odd while an update is in
+// progress. A reader copies what it needs and retries if the sequence was
+// odd or changed meanwhile (see read_spectrum). The file only ever grows, a
+// reader whose mapping is shorter than the header's size must map it again.
+const uint32_t SPECTRUM_MAGIC = 0x43455053; // "SPEC"
+const uint32_t SPECTRUM_VERSION = 1;
+const size_t SPECTRUM_DATA_OFFSET = 64;
+
+struct spectrum_file_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sequence;
+  // number of bins the file has room for
+  uint64_t capacity;
+  // number of bins of the current spectrum, the FFT window size
+  uint64_t size;
+  // CLOCK_REALTIME of the last update, in nanoseconds
+  uint64_t timestamp_ns;
+};
+
+// Copies a consistent snapshot out of a mapped spectrum file. Returns false
+// if the mapping is not a spectrum file or is too short for the spectrum.
+bool read_spectrum(const void *mapping, size_t mapping_size,
+                   spectrum_file_header &header, std::vector<int> &bins);
+
+// Single writer side of the store, not thread-safe
+class spectrum_store {
+public:
+  explicit spectrum_store(const std::string &log_dir);
+
+  ~spectrum_store();
+
+  void update(int idm, const int *bins, size_t size);
+
+private:
+  struct mapped_file {
+    int fd;
+    char *base;
+    size_t capacity;
+  };
+
+  mapped_file &file_of(int idm, size_t size);
+
+  std::string MLogDir;
+  std::unordered_map<int, mapped_file> MFiles;
+};
+
+#endif /* __SPECTRUM_STORE_HPP__ */
@@ -0,0 +1,217 @@
+#include "spectrum_writer.hpp"
+#include "read_json.hpp"
+#include "server_stats.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// spectrum writes in flight at once when batching through io_uring
+const unsigned SPECTRUM_RING_ENTRIES = 256;
+
+spectrum_format parse_spectrum_format(const std::string &name) {
+  if (name == "mmap")
+    return spectrum_format::mmap;
+  return spectrum_format::json;
+}
+
+spectrum_writer::spectrum_writer(const std::string &log_dir,
+                                 spectrum_format format, bool pretty_print,
+                                 std::chrono::milliseconds flush_interval,
+                                 bool use_io_uring)
+    : MLogDir(log_dir), MFormat(format), MPrettyPrint(pretty_print),
+      MFlushInterval(flush_interval), MUseIoUring(use_io_uring) {
+  if (!MLogDir.empty() && MLogDir.back() != '/')
+    MLogDir += '/';
+  if (MFormat == spectrum_format::mmap)
+    MStore.reset(new spectrum_store(MLogDir));
+  MThread = std::thread(&spectrum_writer::writer_loop, this);
+}
+
+spectrum_writer::~spectrum_writer() {
+  {
+    std::lock_guard<std::mutex> guard(MLock);
+    MStop = true;
+  }
+  MWakeUp.notify_one();
+  MThread.join();
+  for (auto &fd : MFds)
+    close(fd.second);
+}
+
+void spectrum_writer::submit(int idm, spectrum_ptr spectrum) {
+  bool was_empty;
+  {
+    std::lock_guard<std::mutex> guard(MLock);
+    was_empty = MPending.empty();
+    MPending[idm] = std::move(spectrum);
+  }
+  if (was_empty)
+    MWakeUp.notify_one();
+}
+
+void spectrum_writer::writer_loop() {
+  // the ring belongs to the thread that submits to it
+  if (MUseIoUring && MFormat == spectrum_format::json) {
+    MRing.reset(new io_ring());
+    if (!MRing->init(SPECTRUM_RING_ENTRIES)) {
+      perror("io_uring setup failed, spectra are saved with pwrite()");
+      MRing.reset();
+    } else if (!MRing->supports(IORING_OP_WRITE)) {
+      std::cerr << "io_uring lacks write, spectra are saved with pwrite()"
+                << std::endl;
+      MRing.reset();
+    }
+  }
+
+  std::unordered_map<int, spectrum_ptr> batch;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(MLock);
+      MWakeUp.wait(guard, [this] { return MStop || !MPending.empty(); });
+      if (MPending.empty() && MStop)
+        return;
+      batch.swap(MPending);
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    write_batch(batch);
+    batch.clear();
+
+    // let updates pile up, so a busy _id is written once per interval
+    std::unique_lock<std::mutex> guard(MLock);
+    MWakeUp.wait_until(guard, start_time + MFlushInterval,
+                       [this] { return MStop; });
+  }
+}
+
+int spectrum_writer::file_of(int idm) {
+  auto res = MFds.find(idm);
+  if (res != MFds.end())
+    return res->second;
+
+  std::string path = MLogDir + std::to_string(idm) + "_spectrum.txt";
+  int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    perror("open() failed");
+    return -1;
+  }
+  MFds[idm] = fd;
+  return fd;
+}
+
+void spectrum_writer::truncate_file(int idm, size_t size) {
+  // a shorter spectrum must not leave the tail of the previous one behind
+  size_t &file_size = MSizes[idm];
+  if (size < file_size && ftruncate(MFds[idm], size) == -1)
+    perror("saving spectrum failed");
+  file_size = size;
+}
+
+void spectrum_writer::format_spectrum(const std::vector<int> &spectrum,
+                                      std::string &str) {
+  str.clear();
+  if (MPrettyPrint) {
+    std::stringstream ss;
+    pretty_print(ss, json::array(spectrum.begin(), spectrum.end()));
+    str = ss.str();
+  } else {
+    serialize_int_array(str, spectrum.data(), spectrum.size());
+  }
+}
+
+void spectrum_writer::write_batch(
+    const std::unordered_map<int, spectrum_ptr> &batch) {
+  if (!MRing) {
+    for (auto &elem : batch)
+      write_spectrum(elem.first, *elem.second);
+    return;
+  }
+
+  // Up to SPECTRUM_RING_ENTRIES writes per io_uring_enter(), instead of one
+  // pwrite() and ftruncate() per spectrum
+  std::vector<int> short_writes;
+  auto it = batch.begin();
+  while (it != batch.end()) {
+    auto start_time = std::chrono::steady_clock::now();
+    MRingBuffers.resize(SPECTRUM_RING_ENTRIES);
+    MRingIdms.resize(SPECTRUM_RING_ENTRIES);
+    unsigned queued = 0;
+    for (; it != batch.end() && queued < SPECTRUM_RING_ENTRIES; ++it) {
+      int fd = file_of(it->first);
+      if (fd == -1)
+        continue;
+      std::string &str = MRingBuffers[queued];
+      format_spectrum(*it->second, str);
+      MRingIdms[queued] = it->first;
+      io_uring_sqe *sqe = MRing->get_sqe();
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = fd;
+      sqe->addr = reinterpret_cast<uint64_t>(str.data());
+      sqe->len = str.size();
+      sqe->off = 0;
+      sqe->user_data = queued;
+      ++queued;
+    }
+
+    unsigned completed = 0;
+    while (completed < queued) {
+      if (MRing->submit_and_wait(1) == -1) {
+        perror("io_uring_enter() failed");
+        exit(EXIT_FAILURE);
+      }
+      completed += MRing->for_each_cqe([&](const io_uring_cqe &cqe) {
+        int idm = MRingIdms[cqe.user_data];
+        size_t size = MRingBuffers[cqe.user_data].size();
+        if (cqe.res < 0) {
+          errno = -cqe.res;
+          perror("saving spectrum failed");
+        } else if (size_t(cqe.res) == size) {
+          // like after pwrite(), only a complete spectrum cuts the file
+          truncate_file(idm, size);
+        } else {
+          std::cerr << "saving spectrum " << idm << " wrote " << cqe.res
+                    << " of " << size << " bytes, retrying" << std::endl;
+          size_t &file_size = MSizes[idm];
+          file_size = std::max(file_size, size_t(cqe.res));
+          short_writes.push_back(idm);
+        }
+      });
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start_time;
+    uint64_t ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    for (unsigned i = 0; i < queued; ++i)
+      record_latency(stage::persist, ns / queued);
+  }
+
+  // A short write leaves the start of the new spectrum over the old one.
+  // It is written again on the next flush, unless a newer one is pending.
+  if (!short_writes.empty()) {
+    std::lock_guard<std::mutex> guard(MLock);
+    for (int idm : short_writes)
+      MPending.emplace(idm, batch.at(idm));
+  }
+}
+
+void spectrum_writer::write_spectrum(int idm,
+                                     const std::vector<int> &spectrum) {
+  stage_timer timer(stage::persist);
+  if (MStore) {
+    MStore->update(idm, spectrum.data(), spectrum.size());
+    return;
+  }
+
+  int fd = file_of(idm);
+  if (fd == -1)
+    return;
+  format_spectrum(spectrum, MBuffer);
+  if (pwrite(fd, MBuffer.data(), MBuffer.size(), 0) == -1)
+    perror("saving spectrum failed");
+  else
+    truncate_file(idm, MBuffer.size());
+}
@@ -0,0 +1,78 @@
+#ifndef __SPECTRUM_WRITER_HPP__
+#define __SPECTRUM_WRITER_HPP__
+
+#include "io_ring.hpp"
+#include "spectrum_store.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+typedef std::shared_ptr<const std::vector<int>> spectrum_ptr;
+
+// json writes $DIR/$IDM_spectrum.txt, mmap updates $DIR/$IDM_spectrum.bin in
+// place (see spectrum_store.hpp)
+enum class spectrum_format { json, mmap };
+
+spectrum_format parse_spectrum_format(const std::string &name);
+
+// Background persistence of spectra to $DIR/$IDM_spectrum.*. The hot path
+// only hands a spectrum over. Updates of one _id that arrive before it was
+// written replace each other, and the writer thread saves whatever is pending
+// in batches, at most once per flush interval. With use_io_uring the json
+// writes of a batch go to the kernel in one submission.
+class spectrum_writer {
+public:
+  spectrum_writer(const std::string &log_dir, spectrum_format format,
+                  bool pretty_print, std::chrono::milliseconds flush_interval,
+                  bool use_io_uring = false);
+
+  ~spectrum_writer();
+
+  void submit(int idm, spectrum_ptr spectrum);
+
+private:
+  void writer_loop();
+
+  void write_batch(const std::unordered_map<int, spectrum_ptr> &batch);
+
+  void write_spectrum(int idm, const std::vector<int> &spectrum);
+
+  void format_spectrum(const std::vector<int> &spectrum, std::string &str);
+
+  // -1 if the file can't be opened, that is retried on the next write
+  int file_of(int idm);
+
+  void truncate_file(int idm, size_t size);
+
+  std::string MLogDir;
+  spectrum_format MFormat;
+  bool MPrettyPrint;
+  std::chrono::milliseconds MFlushInterval;
+  bool MUseIoUring;
+
+  std::mutex MLock;
+  std::condition_variable MWakeUp;
+  std::unordered_map<int, spectrum_ptr> MPending;
+  bool MStop = false;
+
+  // owned by the writer thread only
+  std::unordered_map<int, int> MFds;
+  // current file sizes, only a shrinking spectrum needs an ftruncate()
+  std::unordered_map<int, size_t> MSizes;
+  std::string MBuffer;
+  std::unique_ptr<spectrum_store> MStore;
+  // null when io_uring is off or not available
+  std::unique_ptr<io_ring> MRing;
+  // text and _id of every write in flight, user_data is the index
+  std::vector<std::string> MRingBuffers;
+  std::vector<int> MRingIdms;
+
+  std::thread MThread;
+};
+
+#endif /* __SPECTRUM_WRITER_HPP__ */
@@ -0,0 +1,92 @@
+#include "thread_pool.hpp"
+
+// the pool and queue the calling thread works on, if it's a worker
+static thread_local const thread_pool *current_pool = nullptr;
+static thread_local size_t current_queue = 0;
+
+thread_pool::thread_pool(size_t num_workers) {
+  for (size_t i = 0; i < num_workers; ++i)
+    MQueues.emplace_back(new worker_queue);
+  for (size_t i = 0; i < num_workers; ++i)
+    MWorkers.emplace_back(&thread_pool::worker_loop, this, i);
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> guard(MSleepLock);
+    MStop = true;
+  }
+  MWakeUp.notify_all();
+  for (auto &worker : MWorkers)
+    worker.join();
+}
+
+void thread_pool::submit(job new_job) {
+  // a reactor keeps its queue, the others steal from it when they run dry
+  thread_local const thread_pool *home_pool = nullptr;
+  thread_local size_t home_queue = 0;
+  size_t index;
+  if (current_pool == this) {
+    index = current_queue;
+  } else {
+    if (home_pool != this) {
+      home_pool = this;
+      home_queue = MNextQueue++ % MQueues.size();
+    }
+    index = home_queue;
+  }
+
+  {
+    auto &queue = *MQueues[index];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    queue.jobs.push_back(std::move(new_job));
+    // counted under the queue lock, so a pop can't decrement it first
+    ++MPending;
+  }
+  // Pairs with worker_loop(): either the worker sees the job before it
+  // sleeps, or this sees the sleeper and wakes it up
+  if (MSleeping.load() > 0) {
+    { std::lock_guard<std::mutex> guard(MSleepLock); }
+    MWakeUp.notify_one();
+  }
+}
+
+bool thread_pool::try_pop(size_t index, job &out) {
+  for (size_t i = 0; i < MQueues.size(); ++i) {
+    auto &queue = *MQueues[(index + i) % MQueues.size()];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.jobs.empty())
+      continue;
+    if (i == 0) {
+      out = std::move(queue.jobs.front());
+      queue.jobs.pop_front();
+    } else {
+      out = std::move(queue.jobs.back());
+      queue.jobs.pop_back();
+    }
+    --MPending;
+    return true;
+  }
+  return false;
+}
+
+void thread_pool::worker_loop(size_t index) {
+  current_pool = this;
+  current_queue = index;
+  job next_job;
+  while (true) {
+    if (try_pop(index, next_job)) {
+      next_job();
+      next_job = nullptr;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> guard(MSleepLock);
+    ++MSleeping;
+    // a job pushed after the scan above is counted in MPending already
+    MWakeUp.wait(guard, [this] { return MStop || MPending.load() > 0; });
+    --MSleeping;
+    if (MStop)
+      return;
+  }
+}
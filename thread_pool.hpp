@@ -0,0 +1,55 @@
+#ifndef __THREAD_POOL_HPP__
+#define __THREAD_POOL_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool: every worker has its own queue and takes jobs from the
+// front of it, an idle worker steals from the back of the others' queues.
+// A thread outside the pool, e.g. a reactor, always submits to the same
+// queue and a worker to its own, so submitters don't share a lock. The
+// pending count is atomic, the sleep lock is only taken when a worker runs
+// out of jobs or has to be woken up.
+class thread_pool {
+public:
+  typedef std::function<void()> job;
+
+  explicit thread_pool(size_t num_workers);
+
+  ~thread_pool();
+
+  void submit(job new_job);
+
+  inline size_t size() const { return MWorkers.size(); }
+
+private:
+  struct worker_queue {
+    std::mutex lock;
+    std::deque<job> jobs;
+  };
+
+  void worker_loop(size_t index);
+
+  // the own queue first, then the others
+  bool try_pop(size_t index, job &out);
+
+  std::vector<std::unique_ptr<worker_queue>> MQueues;
+  std::vector<std::thread> MWorkers;
+  // jobs queued but not yet taken by a worker
+  std::atomic<size_t> MPending{0};
+  // workers waiting for MWakeUp, submit() only notifies when there are any
+  std::atomic<size_t> MSleeping{0};
+  // hands out the queues of submitting threads round-robin, once per thread
+  std::atomic<size_t> MNextQueue{0};
+  std::mutex MSleepLock;
+  std::condition_variable MWakeUp;
+  bool MStop = false;
+};
+
+#endif /* __THREAD_POOL_HPP__ */
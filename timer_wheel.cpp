@@ -0,0 +1,168 @@
+#include "timer_wheel.hpp"
+#include <climits>
+
+timer::~timer() {
+  if (MWheel)
+    MWheel->cancel(*this);
+}
+
+timer_wheel::timer_wheel(std::chrono::milliseconds tick)
+    : MStart(clock::now()), MTick(tick) {}
+
+timer_wheel::~timer_wheel() {
+  // timers that outlive the wheel must not reach back into it
+  auto detach = [](slot_list &list) {
+    for (timer *t = list.head; t; t = t->MNext)
+      t->MWheel = nullptr;
+  };
+  for (auto &level : MSlots)
+    for (auto &list : level)
+      detach(list);
+  detach(MOverflow);
+}
+
+uint64_t timer_wheel::tick_of(clock::time_point time) const {
+  if (time <= MStart)
+    return 0;
+  return (time - MStart) / MTick;
+}
+
+void timer_wheel::schedule(timer &t, clock::time_point deadline) {
+  if (t.MWheel)
+    cancel(t);
+  // rounded up, a timer never fires early
+  uint64_t tick = 0;
+  if (deadline > MStart)
+    tick = (deadline - MStart + MTick - clock::duration(1)) / MTick;
+  t.MDeadline = std::max(tick, MNow + 1);
+  t.MWheel = this;
+  link(t);
+  ++MSize;
+}
+
+void timer_wheel::cancel(timer &t) {
+  if (t.MWheel != this)
+    return;
+  unlink(t);
+  t.MWheel = nullptr;
+  --MSize;
+}
+
+void timer_wheel::link(timer &t) {
+  uint64_t diff = t.MDeadline ^ MNow;
+  slot_list *list = &MOverflow;
+  t.MLevel = LEVELS;
+  for (int level = 0; level < LEVELS; ++level) {
+    if (diff >> (SLOT_BITS * (level + 1)))
+      continue;
+    t.MLevel = level;
+    t.MSlot = (t.MDeadline >> (SLOT_BITS * level)) & (SLOTS - 1);
+    list = &MSlots[level][t.MSlot];
+    MOccupied[level] |= uint64_t(1) << t.MSlot;
+    break;
+  }
+
+  t.MPrev = nullptr;
+  t.MNext = list->head;
+  if (list->head)
+    list->head->MPrev = &t;
+  list->head = &t;
+}
+
+void timer_wheel::unlink(timer &t) {
+  slot_list &list =
+      t.MLevel < LEVELS ? MSlots[t.MLevel][t.MSlot] : MOverflow;
+  if (t.MPrev)
+    t.MPrev->MNext = t.MNext;
+  else
+    list.head = t.MNext;
+  if (t.MNext)
+    t.MNext->MPrev = t.MPrev;
+  t.MPrev = t.MNext = nullptr;
+  if (!list.head && t.MLevel < LEVELS)
+    MOccupied[t.MLevel] &= ~(uint64_t(1) << t.MSlot);
+}
+
+uint64_t timer_wheel::next_tick() const {
+  // The first occupied slot after the current position, on the lowest level
+  // that has one, is the earliest: lower levels end before higher ones begin
+  for (int level = 0; level < LEVELS; ++level) {
+    int shift = SLOT_BITS * level;
+    unsigned pos = (MNow >> shift) & (SLOTS - 1);
+    uint64_t ahead = pos == SLOTS - 1 ? 0 : ~uint64_t(0) << (pos + 1);
+    uint64_t mask = MOccupied[level] & ahead;
+    if (mask) {
+      uint64_t base = MNow >> (shift + SLOT_BITS) << (shift + SLOT_BITS);
+      return base + (uint64_t(__builtin_ctzll(mask)) << shift);
+    }
+  }
+  if (MOverflow.head) {
+    int shift = SLOT_BITS * LEVELS;
+    return ((MNow >> shift) + 1) << shift;
+  }
+  return ~uint64_t(0);
+}
+
+void timer_wheel::step() {
+  ++MNow;
+
+  auto relink_all = [this](slot_list &list) {
+    timer *t = list.head;
+    list.head = nullptr;
+    while (t) {
+      timer *next = t->MNext;
+      link(*t);
+      t = next;
+    }
+  };
+
+  if ((MNow & ((uint64_t(1) << (SLOT_BITS * LEVELS)) - 1)) == 0)
+    relink_all(MOverflow);
+  // top down, a timer moved into the current slot of a lower level is
+  // moved again right away
+  for (int level = LEVELS - 1; level > 0; --level) {
+    int shift = SLOT_BITS * level;
+    if (MNow & ((uint64_t(1) << shift) - 1))
+      continue;
+    unsigned pos = (MNow >> shift) & (SLOTS - 1);
+    MOccupied[level] &= ~(uint64_t(1) << pos);
+    relink_all(MSlots[level][pos]);
+  }
+
+  slot_list &due = MSlots[0][MNow & (SLOTS - 1)];
+  while (timer *t = due.head) {
+    unlink(*t);
+    t->MWheel = nullptr;
+    --MSize;
+    // the callback may destroy the timer it belongs to
+    timer::callback fn = t->MCallback;
+    if (fn)
+      fn();
+  }
+}
+
+void timer_wheel::advance(clock::time_point now) {
+  uint64_t target = tick_of(now);
+  while (MNow < target) {
+    // jump over ticks where nothing happens
+    uint64_t next = next_tick();
+    if (next > target) {
+      MNow = target;
+      return;
+    }
+    MNow = next - 1;
+    step();
+  }
+}
+
+int timer_wheel::timeout_ms(clock::time_point now) const {
+  if (MSize == 0)
+    return -1;
+  clock::time_point deadline = MStart + next_tick() * MTick;
+  if (deadline <= now)
+    return 0;
+  // rounded up, waking before the tick is due would find nothing to do
+  auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - now + std::chrono::milliseconds(1) - clock::duration(1));
+  return std::min<int64_t>(wait.count(), INT_MAX);
+}
@@ -0,0 +1,103 @@
+#ifndef __TIMER_WHEEL_HPP__
+#define __TIMER_WHEEL_HPP__
+
+#include <chrono>
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+class timer_wheel;
+
+// A timer is embedded in whatever it times, e.g. a connection, and linked
+// into the wheel without any allocation. Destroying it cancels it.
+class timer {
+public:
+  typedef std::function<void()> callback;
+
+  timer() = default;
+
+  explicit timer(callback fn) : MCallback(std::move(fn)) {}
+
+  ~timer();
+
+  timer(const timer &) = delete;
+  timer &operator=(const timer &) = delete;
+
+  inline void set_callback(callback fn) { MCallback = std::move(fn); }
+
+  inline bool active() const { return MWheel != nullptr; }
+
+private:
+  friend class timer_wheel;
+
+  timer *MPrev = nullptr;
+  timer *MNext = nullptr;
+  timer_wheel *MWheel = nullptr;
+  uint64_t MDeadline = 0;
+  uint8_t MLevel = 0;
+  uint8_t MSlot = 0;
+  callback MCallback;
+};
+
+// Hierarchical timer wheel with O(1) schedule and cancel. Level l has 64
+// slots of 64^l ticks each. A timer sits on the lowest level where its
+// deadline and the current tick differ, and moves down a level whenever
+// time enters its slot, so it's touched at most once per level. One wheel
+// belongs to one thread.
+class timer_wheel {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  explicit timer_wheel(std::chrono::milliseconds tick);
+
+  ~timer_wheel();
+
+  // (Re)arms t. A deadline in the past fires on the next advance().
+  void schedule(timer &t, clock::time_point deadline);
+
+  void cancel(timer &t);
+
+  // Runs the callbacks of all timers due by now. A callback may schedule,
+  // cancel or destroy any timer, itself included.
+  void advance(clock::time_point now);
+
+  // Milliseconds until advance() has work, for epoll_wait(): -1 without
+  // timers. It may wake up early to move timers down, never late.
+  int timeout_ms(clock::time_point now) const;
+
+  inline size_t size() const { return MSize; }
+
+private:
+  static const int LEVELS = 4;
+  static const int SLOT_BITS = 6;
+  static const int SLOTS = 1 << SLOT_BITS;
+
+  struct slot_list {
+    timer *head = nullptr;
+  };
+
+  uint64_t tick_of(clock::time_point time) const;
+
+  // first tick after MNow at which a slot needs attention, ~0 if none
+  uint64_t next_tick() const;
+
+  void link(timer &t);
+
+  void unlink(timer &t);
+
+  // one tick forward: move timers down and fire the ones due now
+  void step();
+
+  clock::time_point MStart;
+  clock::duration MTick;
+  // every timer with a deadline up to MNow has fired
+  uint64_t MNow = 0;
+  size_t MSize = 0;
+  slot_list MSlots[LEVELS][SLOTS];
+  // non-empty slots of every level
+  uint64_t MOccupied[LEVELS] = {};
+  // deadlines beyond the top level, relinked when it wraps
+  slot_list MOverflow;
+};
+
+#endif /* __TIMER_WHEEL_HPP__ */